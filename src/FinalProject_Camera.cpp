@@ -5,8 +5,10 @@
 #include <sstream>
 #include <iomanip>
 #include <vector>
+#include <deque>
 #include <cmath>
 #include <limits>
+#include <cstdlib>
 #include <opencv2/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
@@ -18,7 +20,9 @@
 #include "matching2D.hpp"
 #include "objectDetection2D.hpp"
 #include "lidarData.hpp"
+#include "lidarRangeImage.hpp"
 #include "camFusion.hpp"
+#include "featureTracks.hpp"
 
 using namespace std;
 
@@ -42,12 +46,88 @@ int main(int argc, const char *argv[])
     // object detection
     string yoloBasePath = dataPath + "dat/yolo/";
     string yoloClassesFile = yoloBasePath + "coco.names";
-    string yoloModelConfiguration = yoloBasePath + "yolov3.cfg";
-    string yoloModelWeights = yoloBasePath + "yolov3.weights";
+    string yoloModel = "yolov3"; // yolov3, yolov3-tiny
+    int yoloInputSize = 416;     // network input width and height, multiple of 32
+    bool bCompareModels = false; // run all models and input sizes over the sequence and report latency and agreement instead of tracking
+
+    // command line: [--model yolov3|yolov3-tiny] [--input-size n] [--compare-models]
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg == "--model" && i + 1 < argc)
+        {
+            yoloModel = argv[++i];
+        }
+        else if (arg == "--input-size" && i + 1 < argc)
+        {
+            yoloInputSize = atoi(argv[++i]);
+        }
+        else if (arg == "--compare-models")
+        {
+            bCompareModels = true;
+        }
+        else
+        {
+            cerr << "unknown argument " << arg << ", usage: " << argv[0] << " [--model yolov3|yolov3-tiny] [--input-size n] [--compare-models]" << endl;
+            return 1;
+        }
+    }
+    if (yoloInputSize <= 0 || yoloInputSize % 32 != 0)
+    {
+        cerr << "--input-size must be a positive multiple of 32" << endl;
+        return 1;
+    }
+
+    string yoloModelConfiguration = yoloBasePath + yoloModel + ".cfg";
+    string yoloModelWeights = yoloBasePath + yoloModel + ".weights";
+    float confThreshold = 0.2; //0.2
+    float nmsThreshold = 0.1;       //0.4 
+    int yoloBatchSize = 1;     // no. of upcoming frames packed into one forward pass (1 = detect frame by frame)
+    int yoloDetectionInterval = 1; // run YOLO on every n-th frame only and propagate boxes with keypoint matches in between (1 = every frame)
+    int minPropagationMatches = 10; // min. no. of keypoint matches per propagated box, otherwise YOLO runs again on the next frame
 
     // Lidar
     string lidarPrefix = "KITTI/2011_09_26/velodyne_points/data/000000";
     string lidarFileType = ".bin";
+    string lidarStage = "FUSED";  // FUSED (load, crop and project in a single pass), SOA (float point cloud with SIMD crop), RANGE_IMAGE (crop on a spherical range image which also serves the box outlier filter)
+    float voxelLeafSize = 0.0;    // leaf size in [m] of the optional voxel-grid downsampling after cropping (0 = keep all points)
+    float boxOutlierRadius = 0.0; // drop box Lidar points with fewer than boxOutlierMinNeighbours neighbours within this radius in [m] (0 = off)
+    int boxOutlierMinNeighbours = 2;
+    string cameraTTCMethod = "ALL_PAIRS"; // ALL_PAIRS (median over all keypoint pairs), SAMPLED (random pairs until the TTC interval is narrow enough)
+    double cameraTTCTolerance = 0.1;     // width of the TTC confidence interval in [s] at which SAMPLED stops
+    int cameraTTCMaxPairs = 20000;       // pair budget of SAMPLED
+    int cameraTTCFrames = 1;             // baseline of the camera TTC in frames, > 1 uses the scale change along keypoint tracks over that many frames
+    LidarRangeImage rangeImage;   // HDL-64 range image used by the RANGE_IMAGE stage
+    vector<LidarPoint> scanPoints; // full scan referenced by rangeImage, reused across frames
+    vector<int> scanIndices;       // scan index of each cropped point (RANGE_IMAGE)
+    vector<int> pointBoxes;        // box of each cropped point after clustering, -1 if none
+
+    // keypoints and descriptors, the instances are created once for the whole sequence
+    DetectorType detectorType = DET_SIFT;       // DET_SHITOMASI, DET_HARRIS, DET_FAST, DET_BRISK, DET_ORB, DET_AKAZE, DET_SIFT
+    DescriptorType descriptorType = DESC_BRISK; // DESC_BRISK, DESC_ORB, DESC_FREAK, DESC_AKAZE, DESC_SIFT
+    FeatureRegistry features(detectorType, descriptorType);
+    int keypointTileCols = 1, keypointTileRows = 1; // detect keypoints on overlapping tiles in parallel (1 x 1 = whole image), e.g. 8 x 2
+    int maxKeypointsPerTile = 0;                    // keypoint budget of each tile (0 = no limit)
+    if (keypointTileCols * keypointTileRows > 1)
+    {
+        features.setTiling(keypointTileCols, keypointTileRows, 32, maxKeypointsPerTile);
+    }
+    bool bMaskKeypoints = false; // detect and describe keypoints only inside the bounding boxes (of the previous frame on propagated frames)
+    float maskMargin = 0.1;      // expansion of each box on every side relative to its size
+    int maskReferenceInterval = 0;        // unmasked reference run of detection and description every N masked frames to report the saving (0 = off)
+    int nMaskedFrames = 0;                // no. of masked frames so far
+    P2Quantile unmaskedKeypointTime(0.5); // running median of the unmasked reference runs
+    P2Quantile maskedKeypointTime(0.5);   // running median of the masked detection and description
+    string keypointMode = "MATCH";       // MATCH (detect, describe and match on every frame), KLT (track keypoints with optical flow)
+    int minKltTracks = 300;              // KLT re-detects keypoints when fewer tracks are left
+    float minKltDistance = 5.0;          // min. distance in [px] of re-detected keypoints to the existing tracks
+    cv::Mat prevImgGray;                 // grayscale image of the previous frame, tracked from in KLT mode
+    P2Quantile keypointStageTime(0.5);   // running median of the time spent on keypoints, descriptors and matching
+    string matcherType = "MAT_BF";       // MAT_BF, MAT_FLANN, MAT_HAMMING_SIMD, MAT_LSH, MAT_GUIDED
+    float guidedSearchRadius = 60;       // half size in [px] of the MAT_GUIDED search window around the predicted keypoint position
+    int lshTables = 6, lshKeyBits = 14; // no. of hash tables and bits per key of the MAT_LSH index
+    int lshProbeLevel = 1;               // buckets probed around the key: 0 (own bucket), 1 (keys within 1 bit), 2 (within 2 bits)
+    bool bLogLshRecall = true;           // compare MAT_LSH with brute force on every frame (costs one brute-force search)
 
     // calibration data for camera and lidar
     cv::Mat P_rect_00(3,4,cv::DataType<double>::type); // 3x4 projection matrix after rectification
@@ -68,12 +148,39 @@ int main(int argc, const char *argv[])
     P_rect_00.at<double>(1,0) = 0.000000e+00; P_rect_00.at<double>(1,1) = 7.215377e+02; P_rect_00.at<double>(1,2) = 1.728540e+02; P_rect_00.at<double>(1,3) = 0.000000e+00;
     P_rect_00.at<double>(2,0) = 0.000000e+00; P_rect_00.at<double>(2,1) = 0.000000e+00; P_rect_00.at<double>(2,2) = 1.000000e+00; P_rect_00.at<double>(2,3) = 0.000000e+00;    
 
+    LidarProjector lidarProjector(P_rect_00, R_rect_00, RT); // camera matrix composed once for the whole sequence
+    vector<LidarPixel> lidarPixels; // pixel coordinates of the cropped Lidar points of the current frame, reused across frames
+
     // misc
     double sensorFrameRate = 10.0 / imgStepWidth; // frames per second for Lidar and camera
     int dataBufferSize = 2;       // no. of images which are held in memory (ring buffer) at the same time
     vector<DataFrame> dataBuffer; // list of data frames which are held in memory at the same time
     bool bVis = false;            // visualize results
 
+    if (bCompareModels)
+    {
+        // load all images of the sequence and compare the available YOLO configurations on them
+        vector<cv::Mat> imgs;
+        for (size_t imgIndex = 0; imgIndex <= imgEndIndex - imgStartIndex; imgIndex+=imgStepWidth)
+        {
+            ostringstream imgNumber;
+            imgNumber << setfill('0') << setw(imgFillWidth) << imgStartIndex + imgIndex;
+            imgs.push_back(cv::imread(imgBasePath + imgPrefix + imgNumber.str() + imgFileType));
+        }
+        compareDetectors(imgs, yoloBasePath, yoloClassesFile, confThreshold, nmsThreshold);
+        return 0;
+    }
+
+    // load YOLO network once for the whole sequence
+    ObjectDetector objectDetector(yoloClassesFile, yoloModelConfiguration, yoloModelWeights, cv::Size(yoloInputSize, yoloInputSize));
+    deque<cv::Mat> batchImgs;                    // images of the current detection batch which have not been processed yet
+    deque<vector<BoundingBox>> batchBoundingBoxes; // detected objects for each image in batchImgs
+    int framesSinceDetection = 0;     // no. of frames whose boxes have been propagated since YOLO ran last
+    bool bPropagationConfident = true; // false if a propagated box lost its keypoint support
+    double lastDetectionTime = 0.0;   // inference time of the last YOLO run, used to report the time saved by propagation
+    P2Quantile ttcDeviation(0.5);     // running median of |TTC Lidar - TTC camera| over the sequence
+    FeatureTrackStore featureTracks(cameraTTCFrames + 1); // keypoint tracks over the last cameraTTCFrames + 1 frames
+
     /* MAIN LOOP OVER ALL IMAGES */
 
     for (size_t imgIndex = 0; imgIndex <= imgEndIndex - imgStartIndex; imgIndex+=imgStepWidth)
@@ -85,12 +192,40 @@ int main(int argc, const char *argv[])
         imgNumber << setfill('0') << setw(imgFillWidth) << imgStartIndex + imgIndex;
         string imgFullFilename = imgBasePath + imgPrefix + imgNumber.str() + imgFileType;
 
-        // load image from file 
-        cv::Mat img = cv::imread(imgFullFilename);
-
         // push image into data frame buffer
         DataFrame frame;
-        frame.cameraImg = img;
+        if (yoloBatchSize > 1)
+        {
+            if (batchImgs.empty())
+            {
+                // load the next batch of images from file and detect objects in all of them with one forward pass
+                vector<cv::Mat> imgs;
+                for (size_t batchIndex = imgIndex; batchIndex <= imgEndIndex - imgStartIndex && (int)imgs.size() < yoloBatchSize; batchIndex += imgStepWidth)
+                {
+                    ostringstream batchNumber;
+                    batchNumber << setfill('0') << setw(imgFillWidth) << imgStartIndex + batchIndex;
+                    imgs.push_back(cv::imread(imgBasePath + imgPrefix + batchNumber.str() + imgFileType));
+                }
+
+                vector<vector<BoundingBox>> bBoxes;
+                objectDetector.detectBatch(imgs, bBoxes, confThreshold, nmsThreshold, bVis);
+                batchImgs.insert(batchImgs.end(), imgs.begin(), imgs.end());
+                batchBoundingBoxes.insert(batchBoundingBoxes.end(), bBoxes.begin(), bBoxes.end());
+
+                cout << "#2 : DETECT & CLASSIFY OBJECTS batch of " << imgs.size() << " frames done in " << 1000 * objectDetector.inferenceTime / 1.0 << " ms ("
+                     << imgs.size() / objectDetector.inferenceTime << " frames/s, batch size " << yoloBatchSize << ")" << endl;
+            }
+
+            frame.cameraImg = batchImgs.front();
+            frame.boundingBoxes = batchBoundingBoxes.front();
+            batchImgs.pop_front();
+            batchBoundingBoxes.pop_front();
+        }
+        else
+        {
+            // load image from file 
+            frame.cameraImg = cv::imread(imgFullFilename);
+        }
         dataBuffer.push_back(frame);
         if (dataBuffer.size() > dataBufferSize)
             dataBuffer.erase(dataBuffer.begin());
@@ -100,44 +235,121 @@ int main(int argc, const char *argv[])
 
         /* DETECT & CLASSIFY OBJECTS */
 
-        float confThreshold = 0.2; //0.2
-        float nmsThreshold = 0.1;       //0.4 
-        detectObjects((dataBuffer.end() - 1)->cameraImg, (dataBuffer.end() - 1)->boundingBoxes, confThreshold, nmsThreshold,
-                      yoloBasePath, yoloClassesFile, yoloModelConfiguration, yoloModelWeights, bVis);
+        // objects are detected on the first frame, every yoloDetectionInterval frames and whenever tracking confidence drops
+        bool bDetectObjects = yoloBatchSize > 1 || yoloDetectionInterval <= 1 || dataBuffer.size() < 2 ||
+                              framesSinceDetection + 1 >= yoloDetectionInterval || !bPropagationConfident;
+        if (yoloBatchSize > 1)
+        {
+            cout << "#2 : DETECT & CLASSIFY OBJECTS taken from batch" << endl;
+        }
+        else if (bDetectObjects)
+        {
+            objectDetector.detect((dataBuffer.end() - 1)->cameraImg, (dataBuffer.end() - 1)->boundingBoxes, confThreshold, nmsThreshold, bVis);
+            framesSinceDetection = 0;
+            lastDetectionTime = objectDetector.inferenceTime;
 
-        cout << "#2 : DETECT & CLASSIFY OBJECTS done" << endl;
+            cout << "#2 : DETECT & CLASSIFY OBJECTS done in " << 1000 * objectDetector.inferenceTime / 1.0 << " ms (" << 1.0 / objectDetector.inferenceTime
+                 << " frames/s, network load " << 1000 * objectDetector.loadTime / 1.0 << " ms, once)" << endl;
+        }
+        else
+        {
+            framesSinceDetection++;
+            cout << "#2 : DETECT & CLASSIFY OBJECTS skipped (detection interval " << yoloDetectionInterval << "), boxes are propagated after matching" << endl;
+        }
 
         /* CROP LIDAR POINTS */
 
         // load 3D Lidar points from file
         string lidarFullFilename = imgBasePath + lidarPrefix + imgNumber.str() + lidarFileType;
-        std::vector<LidarPoint> lidarPoints;
-        loadLidarFromFile(lidarPoints, lidarFullFilename);
-
-        // remove Lidar points based on distance properties
+        double tLidar = (double)cv::getTickCount();
         float minZ = -1.5, maxZ = -0.9, minX = 2.0, maxX = 20.0, maxY = 2.0, minR = 0.1; // focus on ego lane
-        cropLidarPoints(lidarPoints, minX, maxX, maxY, minZ, maxZ, minR);
-    
-        (dataBuffer.end() - 1)->lidarPoints = lidarPoints;
+        if (lidarStage.compare("FUSED") == 0)
+        {
+            // load, crop and project in one pass over the scan
+            if (!loadCropProjectLidar(lidarFullFilename, minX, maxX, maxY, minZ, maxZ, minR, lidarProjector,
+                                      (dataBuffer.end() - 1)->lidarPoints, lidarPixels))
+            {
+                cout << " NOTE: no Lidar points for this frame!" << endl;
+            }
+        }
+        else if (lidarStage.compare("RANGE_IMAGE") == 0)
+        {
+            scanPoints.clear(); // loadLidarFromFile appends
+            if (!loadLidarFromFile(scanPoints, lidarFullFilename))
+            {
+                cout << " NOTE: no Lidar points for this frame!" << endl;
+            }
+
+            // remove Lidar points based on distance properties, visiting only the azimuth/elevation window of the ego lane
+            rangeImage.build(scanPoints);
+            rangeImage.crop(minX, maxX, maxY, minZ, maxZ, minR, (dataBuffer.end() - 1)->lidarPoints, &scanIndices);
 
-        cout << "#3 : CROP LIDAR POINTS done" << endl;
+            lidarProjector.project((dataBuffer.end() - 1)->lidarPoints, lidarPixels);
+        }
+        else
+        {
+            LidarPointCloud lidarCloud;
+            if (!loadLidarFromFile(lidarCloud, lidarFullFilename))
+            {
+                cout << " NOTE: no Lidar points for this frame!" << endl;
+            }
+
+            // remove Lidar points based on distance properties
+            cropLidarPoints(lidarCloud, minX, maxX, maxY, minZ, maxZ, minR);
+
+            toLidarPoints(lidarCloud, (dataBuffer.end() - 1)->lidarPoints);
+            lidarProjector.project((dataBuffer.end() - 1)->lidarPoints, lidarPixels);
+        }
+        tLidar = ((double)cv::getTickCount() - tLidar) / cv::getTickFrequency();
 
+        cout << "#3 : CROP LIDAR POINTS done, kept " << (dataBuffer.end() - 1)->lidarPoints.size() << " points in " << 1000 * tLidar / 1.0 << " ms" << endl;
+
+        if (voxelLeafSize > 0)
+        {
+            // thin out dense regions while keeping the closest point of each voxel
+            size_t nCropped = (dataBuffer.end() - 1)->lidarPoints.size();
+            double tVoxel = (double)cv::getTickCount();
+            downsampleLidarPoints((dataBuffer.end() - 1)->lidarPoints, voxelLeafSize, &lidarPixels);
+            tVoxel = ((double)cv::getTickCount() - tVoxel) / cv::getTickFrequency();
+
+            cout << "#3b : VOXEL GRID DOWNSAMPLING done, " << nCropped << " -> " << (dataBuffer.end() - 1)->lidarPoints.size() << " points in "
+                 << 1000 * tVoxel / 1.0 << " ms (leaf size " << voxelLeafSize << " m)" << endl;
+        }
+
+
+        // the box outlier filter queries the scan range image as long as the cropped points still map to the scan
+        bool bScanImage = lidarStage.compare("RANGE_IMAGE") == 0 && voxelLeafSize <= 0;
 
         /* CLUSTER LIDAR POINT CLOUD */
 
         // associate Lidar points with camera-based ROI
         float shrinkFactor = 0.10; // shrinks each bounding box by the given percentage to avoid 3D object merging at the edges of an ROI
-        clusterLidarWithROI((dataBuffer.end()-1)->boundingBoxes, (dataBuffer.end() - 1)->lidarPoints, shrinkFactor, P_rect_00, R_rect_00, RT);
+        if (bDetectObjects)
+        {
+            clusterLidarWithROI((dataBuffer.end()-1)->boundingBoxes, (dataBuffer.end() - 1)->lidarPoints, lidarPixels, shrinkFactor, &pointBoxes);
+            if (boxOutlierRadius > 0 && bScanImage)
+            {
+                removeLidarOutliers((dataBuffer.end()-1)->boundingBoxes, rangeImage, scanIndices, pointBoxes, boxOutlierRadius, boxOutlierMinNeighbours);
+            }
+            else if (boxOutlierRadius > 0)
+            {
+                removeLidarOutliers((dataBuffer.end()-1)->boundingBoxes, boxOutlierRadius, boxOutlierMinNeighbours);
+            }
+
+            // Visualize 3D objects
+            bVis = false;
+            if(bVis)
+            {
+                show3DObjects((dataBuffer.end()-1)->boundingBoxes, cv::Size(4.0, 20.0), cv::Size(1000, 1000), true);
+            }
+            bVis = false;
 
-        // Visualize 3D objects
-        bVis = false;
-        if(bVis)
+            cout << "#4 : CLUSTER LIDAR POINT CLOUD done" << endl;
+        }
+        else
         {
-            show3DObjects((dataBuffer.end()-1)->boundingBoxes, cv::Size(4.0, 20.0), cv::Size(1000, 1000), true);
+            cout << "#4 : CLUSTER LIDAR POINT CLOUD deferred until boxes are propagated" << endl;
         }
-        bVis = false;
-
-        cout << "#4 : CLUSTER LIDAR POINT CLOUD done" << endl;
         
         
         // REMOVE THIS LINE BEFORE PROCEEDING WITH THE FINAL PROJECT
@@ -149,37 +361,60 @@ int main(int argc, const char *argv[])
         cv::Mat imgGray;
         cv::cvtColor((dataBuffer.end()-1)->cameraImg, imgGray, cv::COLOR_BGR2GRAY);
 
-        // extract 2D keypoints from current image
-        vector<cv::KeyPoint> keypoints; // create empty feature list for current image
-        // string detectorType = "SHITOMASI";
-        // string detectorType = "HARRIS";
-        // string detectorType = "FAST";
-        // string detectorType = "BRISK";
-        // string detectorType = "ORB";
-        // string detectorType = "AKAZE";
-        string detectorType = "SIFT";
-
-        if (detectorType.compare("SHITOMASI") == 0)
+        // restrict keypoints to the objects, propagated frames only know the boxes of the previous frame at this point
+        cv::Mat keypointMask;
+        bool bTimeMasking = bMaskKeypoints && keypointMode.compare("KLT") != 0; // KLT tracking is timed by #7c, not against detection
+        if (bMaskKeypoints)
+        {
+            const vector<BoundingBox> &maskBoxes = bDetectObjects ? (dataBuffer.end() - 1)->boundingBoxes : (dataBuffer.end() - 2)->boundingBoxes;
+            if (maskBoxes.size() > 0)
+            {
+                double areaFraction = makeBoundingBoxMask(maskBoxes, imgGray.size(), maskMargin, keypointMask);
+                cout << "#5a : KEYPOINT MASK covers " << 100 * areaFraction << " % of the image" << endl;
+            }
+        }
+        if (bTimeMasking && maskReferenceInterval > 0 && nMaskedFrames++ % maskReferenceInterval == 0)
         {
-            detKeypointsShiTomasi(keypoints, imgGray, false);
+            // reference run on the same frame, the first (cold) runs are absorbed by the running medians
+            vector<cv::KeyPoint> refKeypoints;
+            cv::Mat refDescriptors;
+            double t = (double)cv::getTickCount();
+            features.detect(refKeypoints, imgGray, false);
+            features.describe(refKeypoints, (dataBuffer.end() - 1)->cameraImg, refDescriptors);
+            unmaskedKeypointTime.add(((double)cv::getTickCount() - t) / cv::getTickFrequency());
         }
-        else if (detectorType.compare("HARRIS") == 0)
+        double tKeypoints = (double)cv::getTickCount();
+        double tKeypointStage = (double)cv::getTickCount();
+
+        // extract 2D keypoints from current image
+        vector<cv::KeyPoint> keypoints; // create empty feature list for current image
+        bool bTrackKlt = keypointMode.compare("KLT") == 0 && dataBuffer.size() > 1;
+        vector<cv::DMatch> kltMatches;  // matches between the tracked keypoints and their origin in the previous frame
+        if (bTrackKlt)
         {
-            //...
-            detKeypointsHarris(keypoints, imgGray, false);
+            trackKeypointsKLT((dataBuffer.end() - 2)->keypoints, prevImgGray, imgGray, keypoints, kltMatches);
+            if ((int)keypoints.size() < minKltTracks)
+            {
+                // new keypoints have no match yet, they are tracked from the next frame on
+                vector<cv::KeyPoint> detected;
+                features.detect(detected, imgGray, false, keypointMask);
+                int nAdded = addUntrackedKeypoints(keypoints, detected, imgGray.size(), minKltDistance);
+                cout << "#5b : RE-DETECT KEYPOINTS added " << nAdded << " keypoints to " << kltMatches.size() << " tracks" << endl;
+            }
         }
         else
         {
-            detKeypointsModern(keypoints, imgGray, detectorType, false);
+            features.detect(keypoints, imgGray, false, keypointMask);
         }
+        prevImgGray = imgGray;
 
         // optional : limit number of keypoints (helpful for debugging and learning)
         bool bLimitKpts = false;
-        if (bLimitKpts)
+        if (bLimitKpts && !bTrackKlt) // tracked keypoints are referenced by their matches
         {
             int maxKeypoints = 50;
 
-            if (detectorType.compare("SHITOMASI") == 0)
+            if (features.detectorType == DET_SHITOMASI)
             { // there is no response info, so keep the first 50 as they are sorted in descending quality order
                 keypoints.erase(keypoints.begin() + maxKeypoints, keypoints.end());
             }
@@ -196,37 +431,112 @@ int main(int argc, const char *argv[])
         /* EXTRACT KEYPOINT DESCRIPTORS */
 
         cv::Mat descriptors;
-        string descriptorType = "BRISK"; // BRISK, BRIEF, ORB, FREAK, AKAZE, SIFT
-        // string descriptorType = "ORB";
-        // string descriptorType = "FREAK";
-        // string descriptorType = "AKAZE";
-        // string descriptorType = "SIFT";
-        descKeypoints((dataBuffer.end() - 1)->keypoints, (dataBuffer.end() - 1)->cameraImg, descriptors, descriptorType);
+        if (keypointMode.compare("KLT") == 0)
+        {
+            cout << "#6 : EXTRACT DESCRIPTORS skipped (KLT tracking)" << endl;
+        }
+        else
+        {
+            features.describe((dataBuffer.end() - 1)->keypoints, (dataBuffer.end() - 1)->cameraImg, descriptors, keypointMask);
+
+            // push descriptors for current frame to end of data buffer
+            (dataBuffer.end() - 1)->descriptors = descriptors;
 
-        // push descriptors for current frame to end of data buffer
-        (dataBuffer.end() - 1)->descriptors = descriptors;
+            cout << "#6 : EXTRACT DESCRIPTORS done" << endl;
+        }
 
-        cout << "#6 : EXTRACT DESCRIPTORS done" << endl;
+        if (bTimeMasking)
+        {
+            tKeypoints = ((double)cv::getTickCount() - tKeypoints) / cv::getTickFrequency();
+            maskedKeypointTime.add(tKeypoints);
+            cout << "#6a : masked keypoints and descriptors in " << 1000 * tKeypoints / 1.0 << " ms, median " << 1000 * maskedKeypointTime.value() / 1.0 << " ms";
+            if (unmaskedKeypointTime.count() > 0)
+            {
+                cout << ", saved " << 1000 * (unmaskedKeypointTime.value() - maskedKeypointTime.value()) / 1.0 << " ms (median) compared to the whole image";
+            }
+            cout << endl;
+        }
+        if (matcherType.compare("MAT_LSH") == 0 && keypointMode.compare("KLT") != 0)
+        {
+            // the index is searched by the descriptors of the next frame
+            double t = (double)cv::getTickCount();
+            (dataBuffer.end() - 1)->lshIndex = std::make_shared<BinaryLshIndex>(lshTables, lshKeyBits, lshProbeLevel);
+            (dataBuffer.end() - 1)->lshIndex->build(descriptors);
+            t = ((double)cv::getTickCount() - t) / cv::getTickFrequency();
+            cout << "#6b : LSH INDEX built in " << 1000 * t / 1.0 << " ms" << endl;
+        }
 
 
+        if (dataBuffer.size() == 1)
+        {
+            featureTracks.addFrame((dataBuffer.end() - 1)->keypoints, vector<cv::DMatch>()); // all tracks start in the first frame
+        }
+
         if (dataBuffer.size() > 1) // wait until at least two images have been processed
         {
 
             /* MATCH KEYPOINT DESCRIPTORS */
             vector<cv::DMatch> matches;
-            string matcherType = "MAT_BF";        // MAT_BF, MAT_FLANN
             string descriptorType = "DES_BINARY"; // DES_BINARY, DES_HOG
             // string selectorType = "SEL_NN";       // SEL_NN, SEL_KNN
             string selectorType = "SEL_KNN"; 
 
-            matchDescriptors((dataBuffer.end() - 2)->keypoints, (dataBuffer.end() - 1)->keypoints,
-                             (dataBuffer.end() - 2)->descriptors, (dataBuffer.end() - 1)->descriptors,
-                             matches, descriptorType, matcherType, selectorType);
+            double tMatch = (double)cv::getTickCount();
+            if (bTrackKlt)
+            {
+                matches = kltMatches;
+            }
+            else
+            {
+                vector<cv::Point2f> predictedKeypoints; // positions of the previous keypoints in the current frame (MAT_GUIDED)
+                if (matcherType.compare("MAT_GUIDED") == 0)
+                {
+                    predictKeypointPositions(*(dataBuffer.end() - 2), predictedKeypoints);
+                }
+                matchDescriptors((dataBuffer.end() - 2)->keypoints, (dataBuffer.end() - 1)->keypoints,
+                                 (dataBuffer.end() - 2)->descriptors, (dataBuffer.end() - 1)->descriptors,
+                                 matches, descriptorType, matcherType, selectorType, (dataBuffer.end() - 2)->lshIndex.get(),
+                                 predictedKeypoints.size() > 0 ? &predictedKeypoints : nullptr, guidedSearchRadius);
+            }
+            tMatch = ((double)cv::getTickCount() - tMatch) / cv::getTickFrequency();
 
             // store matches in current data frame
             (dataBuffer.end() - 1)->kptMatches = matches;
+            (dataBuffer.end() - 1)->medianFlow = getMedianFlow((dataBuffer.end() - 2)->keypoints, (dataBuffer.end() - 1)->keypoints, matches);
+            featureTracks.addFrame((dataBuffer.end() - 1)->keypoints, matches);
 
-            cout << "#7 : MATCH KEYPOINT DESCRIPTORS done" << endl;
+            cout << "#7 : MATCH KEYPOINT DESCRIPTORS done in " << 1000 * tMatch / 1.0 << " ms" << endl;
+            if (bLogLshRecall && (dataBuffer.end() - 2)->lshIndex)
+            {
+                cout << "#7a : LSH recall " << 100 * (dataBuffer.end() - 2)->lshIndex->recall((dataBuffer.end() - 1)->descriptors)
+                     << " % of the brute-force nearest neighbours" << endl;
+            }
+
+            tKeypointStage = ((double)cv::getTickCount() - tKeypointStage) / cv::getTickFrequency();
+            keypointStageTime.add(tKeypointStage);
+            cout << "#7c : KEYPOINT STAGE (" << keypointMode << ") done in " << 1000 * tKeypointStage / 1.0 << " ms, median "
+                 << 1000 * keypointStageTime.value() / 1.0 << " ms" << endl;
+
+            if (!bDetectObjects)
+            {
+                /* PROPAGATE BOUNDING BOXES (NO DETECTION ON THIS FRAME) */
+
+                double t = (double)cv::getTickCount();
+                bPropagationConfident = propagateBoundingBoxes(matches, *(dataBuffer.end()-2), *(dataBuffer.end()-1), minPropagationMatches);
+                clusterLidarWithROI((dataBuffer.end()-1)->boundingBoxes, (dataBuffer.end() - 1)->lidarPoints, lidarPixels, shrinkFactor, &pointBoxes);
+                if (boxOutlierRadius > 0 && bScanImage)
+                {
+                    removeLidarOutliers((dataBuffer.end()-1)->boundingBoxes, rangeImage, scanIndices, pointBoxes, boxOutlierRadius, boxOutlierMinNeighbours);
+                }
+                else if (boxOutlierRadius > 0)
+                {
+                    removeLidarOutliers((dataBuffer.end()-1)->boundingBoxes, boxOutlierRadius, boxOutlierMinNeighbours);
+                }
+                t = ((double)cv::getTickCount() - t) / cv::getTickFrequency();
+
+                cout << "#7b : PROPAGATE BOUNDING BOXES done in " << 1000 * t / 1.0 << " ms, saved " << 1000 * (lastDetectionTime - t) / 1.0
+                     << " ms (detection interval " << yoloDetectionInterval << ", " << (bPropagationConfident ? "confident" : "low confidence, detecting next frame") << ")" << endl;
+            }
 
             
             /* TRACK 3D OBJECT BOUNDING BOXES */
@@ -243,6 +553,7 @@ int main(int argc, const char *argv[])
 
             // store matches in current data frame
             (dataBuffer.end()-1)->bbMatches = bbBestMatches;
+            computeBoxFlows(*(dataBuffer.end()-2), *(dataBuffer.end()-1));
 
             cout << "#8 : TRACK 3D OBJECT BOUNDING BOXES done" << endl;
 
@@ -276,7 +587,7 @@ int main(int argc, const char *argv[])
                     //// STUDENT ASSIGNMENT
                     //// TASK FP.2 -> compute time-to-collision based on Lidar data (implement -> computeTTCLidar)
                     double ttcLidar; 
-                    computeTTCLidar(prevBB->lidarPoints, currBB->lidarPoints, sensorFrameRate, ttcLidar);
+                    computeTTCLidar(*prevBB, *currBB, sensorFrameRate, ttcLidar);
 
                      // Visualize 3D objects
                     bVis = false;
@@ -295,14 +606,53 @@ int main(int argc, const char *argv[])
                     
                     double ttcCamera;
                     clusterKptMatchesWithROI(*currBB, (dataBuffer.end() - 2)->keypoints, (dataBuffer.end() - 1)->keypoints, (dataBuffer.end() - 1)->kptMatches);                    
-                    computeTTCCamera((dataBuffer.end() - 2)->keypoints, (dataBuffer.end() - 1)->keypoints, currBB->kptMatches, sensorFrameRate, ttcCamera);
+
+                    // longer baseline: keypoints of the frame cameraTTCFrames back along the tracks, no extra matching needed
+                    vector<cv::KeyPoint> *ttcKptsPrev = &(dataBuffer.end() - 2)->keypoints, *ttcKptsCurr = &(dataBuffer.end() - 1)->keypoints;
+                    BoundingBox *ttcBB = currBB;
+                    double ttcFrameRate = sensorFrameRate;
+                    vector<cv::KeyPoint> trackKptsOld, trackKptsNew;
+                    vector<cv::DMatch> trackMatches;
+                    BoundingBox trackBB;
+                    if (cameraTTCFrames > 1 && featureTracks.getCorrespondences(cameraTTCFrames, trackKptsOld, trackKptsNew, trackMatches))
+                    {
+                        trackBB.roi = currBB->roi;
+                        clusterKptMatchesWithROI(trackBB, trackKptsOld, trackKptsNew, trackMatches);
+                        ttcKptsPrev = &trackKptsOld;
+                        ttcKptsCurr = &trackKptsNew;
+                        ttcBB = &trackBB;
+                        ttcFrameRate = sensorFrameRate / cameraTTCFrames;
+                        cout << "#9b : " << trackBB.kptMatches.size() << " keypoint tracks in the box span the last " << cameraTTCFrames << " frames" << endl;
+                    }
+
+                    if (cameraTTCMethod.compare("SAMPLED") == 0)
+                    {
+                        double t = (double)cv::getTickCount();
+                        CameraTTCEstimate estimate = computeTTCCameraSampled(*ttcKptsPrev, *ttcKptsCurr, ttcBB->kptMatches,
+                                                                             ttcFrameRate, cameraTTCTolerance, cameraTTCMaxPairs);
+                        t = ((double)cv::getTickCount() - t) / cv::getTickFrequency();
+                        ttcCamera = estimate.ttc;
+                        cout << "#9a : camera TTC from " << estimate.nPairs << " sampled pairs, interval [" << estimate.ttcLow << ", "
+                             << estimate.ttcHigh << "] s in " << 1000 * t / 1.0 << " ms" << endl;
+                    }
+                    else
+                    {
+                        computeTTCCamera(*ttcKptsPrev, *ttcKptsCurr, ttcBB->kptMatches, ttcFrameRate, ttcCamera);
+                    }
                     //// EOF STUDENT ASSIGNMENT
 
+                    if (std::isfinite(ttcLidar) && std::isfinite(ttcCamera))
+                    {
+                        ttcDeviation.add(fabs(ttcLidar - ttcCamera));
+                    }
+                    cout << "#9 : TTC Lidar " << ttcLidar << " s, TTC camera (" << keypointMode << ") " << ttcCamera << " s, median deviation so far "
+                         << ttcDeviation.value() << " s" << endl;
+
                     bVis = true;
                     if (bVis)
                     {
                         cv::Mat visImg = (dataBuffer.end() - 1)->cameraImg.clone();
-                        showLidarImgOverlay(visImg, currBB->lidarPoints, P_rect_00, R_rect_00, RT, &visImg);
+                        showLidarImgOverlay(visImg, currBB->lidarPoints, lidarProjector, &visImg);
                         cv::rectangle(visImg, cv::Point(currBB->roi.x, currBB->roi.y), cv::Point(currBB->roi.x + currBB->roi.width, currBB->roi.y + currBB->roi.height), cv::Scalar(0, 255, 0), 2);
                         
                         char str[200];
@@ -0,0 +1,274 @@
+
+/* MICROBENCHMARKS FOR THE PROCESSING STAGES OF THIS PROJECT */
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "dataStructures.h"
+#include "objectDetection2D.hpp"
+#include "camFusion.hpp"
+#include "matching2D.hpp"
+#include "hammingMatcher.hpp"
+
+using namespace std;
+
+// fills a synthetic YOLO region layer output (rows x 85) where most rows have a low objectness, as in real KITTI frames
+static void makeYoloOutput(cv::Mat &out, int rows, int nClasses, cv::RNG &rng)
+{
+    out.create(rows, 5 + nClasses, CV_32F);
+    for (int j = 0; j < rows; ++j)
+    {
+        float *data = out.ptr<float>(j);
+        data[0] = rng.uniform(0.f, 1.f);
+        data[1] = rng.uniform(0.f, 1.f);
+        data[2] = rng.uniform(0.f, 0.5f);
+        data[3] = rng.uniform(0.f, 0.5f);
+        float objectness = 1.f / (1.f + std::exp(-(float)rng.gaussian(2.0) + 6.f));
+        data[4] = objectness;
+        for (int c = 0; c < nClasses; ++c)
+        {
+            data[5 + c] = objectness * rng.uniform(0.f, 1.f);
+        }
+    }
+}
+
+// compares decodeYoloOutput against the cv::minMaxLoc based reference on the three yolov3 output scales at 416x416
+static bool benchYoloDecoder(int nRuns)
+{
+    cv::RNG rng(42);
+    vector<cv::Mat> outputs(3);
+    int rows[] = {13 * 13 * 3, 26 * 26 * 3, 52 * 52 * 3};
+    for (int i = 0; i < 3; ++i)
+    {
+        makeYoloOutput(outputs[i], rows[i], 80, rng);
+    }
+    cv::Size imgSize(1242, 375);
+    float confThreshold = 0.2;
+
+    vector<int> classIdsRef, classIds; vector<float> confidencesRef, confidences; vector<cv::Rect> boxesRef, boxes;
+    double tRef = 0.0, tNew = 0.0;
+    for (int run = 0; run < nRuns; ++run)
+    {
+        classIdsRef.clear(); confidencesRef.clear(); boxesRef.clear();
+        double t = (double)cv::getTickCount();
+        for (size_t i = 0; i < outputs.size(); ++i)
+            decodeYoloOutputMinMaxLoc((const float*)outputs[i].data, outputs[i].rows, outputs[i].cols, imgSize, confThreshold, classIdsRef, confidencesRef, boxesRef);
+        tRef += ((double)cv::getTickCount() - t) / cv::getTickFrequency();
+
+        classIds.clear(); confidences.clear(); boxes.clear();
+        t = (double)cv::getTickCount();
+        for (size_t i = 0; i < outputs.size(); ++i)
+            decodeYoloOutput((const float*)outputs[i].data, outputs[i].rows, outputs[i].cols, imgSize, confThreshold, classIds, confidences, boxes);
+        tNew += ((double)cv::getTickCount() - t) / cv::getTickFrequency();
+    }
+
+    bool bEqual = classIds == classIdsRef && confidences == confidencesRef && boxes == boxesRef;
+    cout << "YOLO decoder: " << boxes.size() << " candidate boxes, minMaxLoc " << 1000 * tRef / nRuns << " ms, vectorized "
+         << 1000 * tNew / nRuns << " ms, speedup " << tRef / tNew << "x, results " << (bEqual ? "identical" : "DIFFERENT") << endl;
+    return bEqual;
+}
+
+// compares the grid-based keypoint distance ratios against the all-pairs reference on a box with nMatches matches
+// whose keypoints expand by 2% between the frames
+static bool benchDistanceRatios(int nRuns, int nMatches)
+{
+    cv::RNG rng(42);
+    vector<cv::KeyPoint> kptsPrev, kptsCurr;
+    vector<cv::DMatch> matches;
+    for (int i = 0; i < nMatches; ++i)
+    {
+        cv::Point2f pt(rng.uniform(500.f, 800.f), rng.uniform(150.f, 350.f));
+        kptsPrev.push_back(cv::KeyPoint(pt, 7.f));
+        cv::Point2f noise(rng.gaussian(0.5), rng.gaussian(0.5));
+        kptsCurr.push_back(cv::KeyPoint(cv::Point2f(650.f, 250.f) + 1.02f * (pt - cv::Point2f(650.f, 250.f)) + noise, 7.f));
+        matches.push_back(cv::DMatch(i, i, 0.f));
+    }
+
+    vector<double> ratiosRef, ratios;
+    double tRef = 0.0, tNew = 0.0;
+    for (int run = 0; run < nRuns; ++run)
+    {
+        ratiosRef.clear();
+        double t = (double)cv::getTickCount();
+        getKeyPointDistanceRatiosAllPairs(kptsPrev, kptsCurr, matches, ratiosRef);
+        tRef += ((double)cv::getTickCount() - t) / cv::getTickFrequency();
+
+        ratios.clear();
+        t = (double)cv::getTickCount();
+        getKeyPointDistanceRatios(kptsPrev, kptsCurr, matches, ratios);
+        tNew += ((double)cv::getTickCount() - t) / cv::getTickFrequency();
+    }
+
+    size_t nRef = ratiosRef.size(), nNew = ratios.size();
+    double medianRef = getMedianFromVector(ratiosRef, 0, (int)nRef - 1);
+    double median = getMedianFromVector(ratios, 0, (int)nNew - 1);
+    bool bEqual = nRef == nNew && median == medianRef;
+    cout << "Distance ratios (" << nMatches << " matches): " << nNew << " ratios, all pairs " << 1000 * tRef / nRuns << " ms, grid "
+         << 1000 * tNew / nRuns << " ms, speedup " << tRef / tNew << "x, median " << (bEqual ? "identical" : "DIFFERENT") << endl;
+    return bEqual;
+}
+
+// compares grid-based Harris NMS against the overlap-based implementation on the response of a KITTI frame; fails if the grid
+// result contains overlapping keypoints or if less than minAgreement of either keypoint set has a partner in the other one
+static bool benchHarrisNms(int nRuns, string imgFile, double minAgreement)
+{
+    cv::Mat img = cv::imread(imgFile, cv::IMREAD_GRAYSCALE);
+    if (img.empty())
+    {
+        cerr << "Harris NMS: cannot read " << imgFile << endl;
+        return false;
+    }
+    cv::Mat dst, response;
+    cv::cornerHarris(img, dst, 2, 3, 0.04, cv::BORDER_DEFAULT);
+    cv::normalize(dst, response, 0, 255, cv::NORM_MINMAX, CV_32FC1, cv::Mat());
+    int minResponse = 100;
+    float keypointSize = 6;
+
+    vector<cv::KeyPoint> kptsRef, kpts;
+    double tRef = 0.0, tNew = 0.0;
+    for (int run = 0; run < nRuns; ++run)
+    {
+        kptsRef.clear();
+        double t = (double)cv::getTickCount();
+        nmsHarrisOverlap(response, minResponse, keypointSize, kptsRef);
+        tRef += ((double)cv::getTickCount() - t) / cv::getTickFrequency();
+
+        kpts.clear();
+        t = (double)cv::getTickCount();
+        nmsHarrisGrid(response, minResponse, keypointSize, kpts);
+        tNew += ((double)cv::getTickCount() - t) / cv::getTickFrequency();
+    }
+
+    // agreement: share of the keypoints of one set which have a partner of the other set within half a keypoint size
+    auto countMatched = [keypointSize](const vector<cv::KeyPoint> &a, const vector<cv::KeyPoint> &b) {
+        int nMatched = 0;
+        for (const cv::KeyPoint &kpA : a)
+        {
+            for (const cv::KeyPoint &kpB : b)
+            {
+                if (cv::norm(kpA.pt - kpB.pt) <= keypointSize / 2)
+                {
+                    nMatched++;
+                    break;
+                }
+            }
+        }
+        return nMatched;
+    };
+    int nRefMatched = countMatched(kptsRef, kpts), nMatched = countMatched(kpts, kptsRef);
+
+    // the grid result must not contain overlapping keypoints
+    bool bDisjoint = true;
+    for (size_t i = 0; i < kpts.size() && bDisjoint; ++i)
+    {
+        for (size_t j = i + 1; j < kpts.size(); ++j)
+        {
+            if (cv::KeyPoint::overlap(kpts[i], kpts[j]) > 0)
+            {
+                bDisjoint = false;
+                break;
+            }
+        }
+    }
+
+    double refAgreement = (double)nRefMatched / max(kptsRef.size(), (size_t)1), agreement = (double)nMatched / max(kpts.size(), (size_t)1);
+    bool bAgree = refAgreement >= minAgreement && agreement >= minAgreement;
+
+    cout << "Harris NMS: " << kptsRef.size() << " / " << kpts.size() << " keypoints, overlap " << 1000 * tRef / nRuns << " ms, grid "
+         << 1000 * tNew / nRuns << " ms, speedup " << tRef / tNew << "x, " << 100 * refAgreement
+         << "% of the overlap keypoints and " << 100 * agreement << "% of the grid keypoints matched"
+         << (bAgree ? "" : " (BELOW THRESHOLD)") << ", " << (bDisjoint ? "no overlaps" : "OVERLAPPING KEYPOINTS") << endl;
+    return bDisjoint && bAgree;
+}
+
+// compares the packed Hamming matcher against cv::BFMatcher(NORM_HAMMING) on BRISK descriptors of consecutive KITTI frames
+static bool benchHammingMatcher(int nRuns, string imgPrefix, int nFrames)
+{
+    cv::Ptr<cv::FeatureDetector> detector = createDetector(DET_BRISK);
+    cv::Ptr<cv::DescriptorExtractor> extractor = createDescriptorExtractor(DESC_BRISK);
+    vector<cv::Mat> descriptors;
+    for (int i = 0; i < nFrames; ++i)
+    {
+        char imgFile[32];
+        sprintf(imgFile, "%010d.png", i);
+        cv::Mat img = cv::imread(imgPrefix + imgFile, cv::IMREAD_GRAYSCALE);
+        if (img.empty())
+        {
+            cerr << "Hamming matcher: cannot read " << imgPrefix + imgFile << endl;
+            return false;
+        }
+        vector<cv::KeyPoint> keypoints;
+        cv::Mat desc;
+        detector->detect(img, keypoints);
+        extractor->compute(img, keypoints, desc);
+        descriptors.push_back(desc);
+    }
+
+    cv::Ptr<cv::DescriptorMatcher> matcher = cv::BFMatcher::create(cv::NORM_HAMMING, false);
+    bool bEqual = true;
+    double tRef = 0.0, tNew = 0.0;
+    size_t nQueries = 0;
+    for (int i = 0; i + 1 < nFrames; ++i)
+    {
+        vector<vector<cv::DMatch>> knnRef, knn;
+        for (int run = 0; run < nRuns; ++run)
+        {
+            double t = (double)cv::getTickCount();
+            matcher->knnMatch(descriptors[i], descriptors[i + 1], knnRef, 2);
+            tRef += ((double)cv::getTickCount() - t) / cv::getTickFrequency();
+
+            t = (double)cv::getTickCount();
+            hammingKnnMatch(PackedBinaryDescriptors(descriptors[i]), PackedBinaryDescriptors(descriptors[i + 1]), knn, 2);
+            tNew += ((double)cv::getTickCount() - t) / cv::getTickFrequency();
+        }
+        nQueries += descriptors[i].rows;
+
+        bEqual = bEqual && knn.size() == knnRef.size();
+        for (size_t q = 0; q < knn.size() && bEqual; ++q)
+        {
+            bEqual = knn[q].size() == knnRef[q].size();
+            for (size_t j = 0; j < knn[q].size() && bEqual; ++j)
+            {
+                bEqual = knn[q][j].queryIdx == knnRef[q][j].queryIdx && knn[q][j].trainIdx == knnRef[q][j].trainIdx &&
+                         knn[q][j].imgIdx == knnRef[q][j].imgIdx && knn[q][j].distance == knnRef[q][j].distance;
+            }
+        }
+    }
+
+    int nPairs = nFrames - 1;
+    cout << "Hamming matcher (" << nPairs << " KITTI frame pairs, " << nQueries / nPairs << " BRISK descriptors per frame): BFMatcher "
+         << 1000 * tRef / (nRuns * nPairs) << " ms, packed " << 1000 * tNew / (nRuns * nPairs) << " ms per pair, speedup " << tRef / tNew
+         << "x, results " << (bEqual ? "identical" : "DIFFERENT") << endl;
+    return bEqual;
+}
+
+/* MAIN PROGRAM */
+int main(int argc, const char *argv[])
+{
+    string benchmark = argc > 1 ? argv[1] : "all"; // name of the benchmark to run
+    int nRuns = 100;
+
+    bool bOk = true;
+    if (benchmark == "all" || benchmark == "yolo")
+    {
+        bOk = benchYoloDecoder(nRuns) && bOk;
+    }
+    if (benchmark == "all" || benchmark == "ratios")
+    {
+        bOk = benchDistanceRatios(10, 2000) && bOk;
+    }
+    if (benchmark == "all" || benchmark == "harris")
+    {
+        bOk = benchHarrisNms(3, "../images/KITTI/2011_09_26/image_02/data/0000000000.png", 0.95) && bOk;
+    }
+    if (benchmark == "all" || benchmark == "hamming")
+    {
+        bOk = benchHammingMatcher(5, "../images/KITTI/2011_09_26/image_02/data/", 10) && bOk;
+    }
+
+    return bOk ? 0 : 1;
+}
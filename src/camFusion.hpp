@@ -6,21 +6,77 @@
 #include <vector>
 #include <opencv2/core.hpp>
 #include "dataStructures.h"
-#include <queue>
+#include "lidarData.hpp"
+
+// statistics of the span [first, last), which is partially reordered in place by nth_element (no sorting, no allocations);
+// an empty span yields NAN
+double getMedianInPlace(double *first, double *last);
+double getQuantileInPlace(double *first, double *last, double q); // q in [0, 1], linear interpolation between order statistics
+double getIQRInPlace(double *first, double *last);                // interquartile range q(0.75) - q(0.25)
+
+// median of vec[start..end] (both inclusive), reorders this range of vec in place
+double getMedianFromVector(std::vector<double> &vec, int start, int end);
+
+// streaming estimate of a single quantile with constant memory (P-square algorithm by Jain and Chlamtac),
+// for values which arrive one at a time and are not kept; exact for the first five values
+class P2Quantile
+{
+public:
+    explicit P2Quantile(double q=0.5);
+
+    void add(double x);
+    double value() const;
+    size_t count() const { return n; }
+
+private:
+    double parabolic(int i, int d) const;
+    double linear(int i, int d) const;
+
+    double p;             // quantile to estimate
+    size_t n;             // no. of values seen so far
+    double heights[5];    // marker heights: min, p/2, p, (1+p)/2 and max quantile estimates
+    double positions[5];  // actual marker positions (1-based ranks)
+    double desired[5];    // desired marker positions
+    double increments[5]; // increments of the desired positions per value
+};
 
-float getMedianFromQueue(std::priority_queue<float> q);
-double getMedianFromVector(std::vector<double> vec, int start, int end);
 void getKeyPointDistanceRatios(std::vector<cv::KeyPoint> &kptsPrev, std::vector<cv::KeyPoint> &kptsCurr, std::vector<cv::DMatch> &kptMatches, std::vector<double> &distRatios);
+void getKeyPointDistanceRatiosAllPairs(std::vector<cv::KeyPoint> &kptsPrev, std::vector<cv::KeyPoint> &kptsCurr, std::vector<cv::DMatch> &kptMatches, std::vector<double> &distRatios);
 
 void clusterLidarWithROI(std::vector<BoundingBox> &boundingBoxes, std::vector<LidarPoint> &lidarPoints, float shrinkFactor, cv::Mat &P_rect_xx, cv::Mat &R_rect_xx, cv::Mat &RT);
+// pointBoxes (if given) receives the index of the box each point was added to, -1 for points outside or in several boxes
+void clusterLidarWithROI(std::vector<BoundingBox> &boundingBoxes, std::vector<LidarPoint> &lidarPoints, std::vector<LidarPixel> &pixels, float shrinkFactor,
+                         std::vector<int> *pointBoxes=nullptr);
 void clusterKptMatchesWithROI(BoundingBox &boundingBox, std::vector<cv::KeyPoint> &kptsPrev, std::vector<cv::KeyPoint> &kptsCurr, std::vector<cv::DMatch> &kptMatches);
 void matchBoundingBoxes(std::vector<cv::DMatch> &matches, std::map<int, int> &bbBestMatches, DataFrame &prevFrame, DataFrame &currFrame);
+bool propagateBoundingBoxes(std::vector<cv::DMatch> &matches, DataFrame &prevFrame, DataFrame &currFrame, int minKptMatches);
+
+// motion of the image content between frames, used to predict keypoint positions for guided matching
+cv::Point2f getMedianFlow(std::vector<cv::KeyPoint> &kptsPrev, std::vector<cv::KeyPoint> &kptsCurr, std::vector<cv::DMatch> &kptMatches);
+void computeBoxFlows(DataFrame &prevFrame, DataFrame &currFrame);
+void predictKeypointPositions(const DataFrame &frame, std::vector<cv::Point2f> &predicted);
 
 void show3DObjects(std::vector<BoundingBox> &boundingBoxes, cv::Size worldSize, cv::Size imageSize, bool bWait=true);
 // void show3DObjects(std::vector<BoundingBox> &boundingBoxes, cv::Size worldSize, cv::Size imageSize, bool bWait=true, std::string="x.png");
 
 void computeTTCCamera(std::vector<cv::KeyPoint> &kptsPrev, std::vector<cv::KeyPoint> &kptsCurr,
-                      std::vector<cv::DMatch> kptMatches, double frameRate, double &TTC, cv::Mat *visImg=nullptr);
+                      std::vector<cv::DMatch> &kptMatches, double frameRate, double &TTC, cv::Mat *visImg=nullptr);
+
+// result of the sampled camera TTC estimator
+struct CameraTTCEstimate
+{
+    double ttc;              // TTC from the median distance ratio of the sampled pairs in [s]
+    int nPairs;              // no. of keypoint pairs in the distance band which have been used
+    double ttcLow, ttcHigh;  // confidence interval of the TTC in [s], infinite if it includes a distance ratio of 1
+};
+
+// same model as computeTTCCamera, but random pairs of matches in the valid distance band are drawn in batches until the
+// confidence interval of the median ratio (order statistics, ~95%) maps to a TTC interval narrower than ttcTolerance [s]
+// or maxPairs pairs have been used; the random generator is seeded with a fixed value, so results are reproducible
+CameraTTCEstimate computeTTCCameraSampled(std::vector<cv::KeyPoint> &kptsPrev, std::vector<cv::KeyPoint> &kptsCurr, std::vector<cv::DMatch> &kptMatches,
+                                          double frameRate, double ttcTolerance=0.1, int maxPairs=20000, int batchSize=500);
 void computeTTCLidar(std::vector<LidarPoint> &lidarPointsPrev,
                      std::vector<LidarPoint> &lidarPointsCurr, double frameRate, double &TTC);                  
+double getLidarMinX(BoundingBox &boundingBox, double clusterTolerance=0.2, int minClusterSize=3);
+void computeTTCLidar(BoundingBox &prevBB, BoundingBox &currBB, double frameRate, double &TTC);
 #endif /* camFusion_hpp */
@@ -2,59 +2,140 @@
 #include <iostream>
 #include <algorithm>
 #include <numeric>
+#include <climits>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
 #include "camFusion.hpp"
 #include "dataStructures.h"
-#include <queue>
+#include "lidarData.hpp"
+#include "lidarClustering.hpp"
 using namespace std;
 
 
 // Create groups of Lidar points whose projection into the camera falls into the same bounding box
 void clusterLidarWithROI(std::vector<BoundingBox> &boundingBoxes, std::vector<LidarPoint> &lidarPoints, float shrinkFactor, cv::Mat &P_rect_xx, cv::Mat &R_rect_xx, cv::Mat &RT)
 {
-    // loop over all Lidar points and associate them to a 2D bounding box
-    cv::Mat X(4, 1, cv::DataType<double>::type);
-    cv::Mat Y(3, 1, cv::DataType<double>::type);
-
-    for (auto it1 = lidarPoints.begin(); it1 != lidarPoints.end(); ++it1)
-    {
-        // assemble vector for matrix-vector-multiplication
-        X.at<double>(0, 0) = it1->x;
-        X.at<double>(1, 0) = it1->y;
-        X.at<double>(2, 0) = it1->z;
-        X.at<double>(3, 0) = 1;
-
-        // project Lidar point into camera
-        Y = P_rect_xx * R_rect_xx * RT * X;
-        cv::Point pt;
-        pt.x = Y.at<double>(0, 0) / Y.at<double>(0, 2); // pixel coordinates
-        pt.y = Y.at<double>(1, 0) / Y.at<double>(0, 2);
-
-        vector<vector<BoundingBox>::iterator> enclosingBoxes; // pointers to all bounding boxes which enclose the current Lidar point
-        for (vector<BoundingBox>::iterator it2 = boundingBoxes.begin(); it2 != boundingBoxes.end(); ++it2)
-        {
-            // shrink current bounding box slightly to avoid having too many outlier points around the edges
-            cv::Rect smallerBox;
-            smallerBox.x = (*it2).roi.x + shrinkFactor * (*it2).roi.width / 2.0;
-            smallerBox.y = (*it2).roi.y + shrinkFactor * (*it2).roi.height / 2.0;
-            smallerBox.width = (*it2).roi.width * (1 - shrinkFactor);
-            smallerBox.height = (*it2).roi.height * (1 - shrinkFactor);
-
-            // check wether point is within current bounding box
-            if (smallerBox.contains(pt))
+    // project Lidar points into camera
+    LidarProjector projector(P_rect_xx, R_rect_xx, RT);
+    vector<LidarPixel> pixels;
+    projector.project(lidarPoints, pixels);
+
+    clusterLidarWithROI(boundingBoxes, lidarPoints, pixels, shrinkFactor);
+}
+
+// same as above for Lidar points which have already been projected into the camera
+void clusterLidarWithROI(std::vector<BoundingBox> &boundingBoxes, std::vector<LidarPoint> &lidarPoints, std::vector<LidarPixel> &pixels, float shrinkFactor,
+                         std::vector<int> *pointBoxes)
+{
+    if (pointBoxes != nullptr)
+    {
+        pointBoxes->assign(lidarPoints.size(), -1);
+    }
+
+    // pixel extent of the points in front of the camera, the grid never has to reach beyond it
+    cv::Point pixelMin(INT_MAX, INT_MAX), pixelMax(INT_MIN, INT_MIN);
+    for (size_t i = 0; i < pixels.size(); ++i)
+    {
+        if (pixels[i].bInFront)
+        {
+            pixelMin.x = min(pixelMin.x, pixels[i].pt.x);
+            pixelMin.y = min(pixelMin.y, pixels[i].pt.y);
+            pixelMax.x = max(pixelMax.x, pixels[i].pt.x);
+            pixelMax.y = max(pixelMax.y, pixels[i].pt.y);
+        }
+    }
+    if (pixelMax.x < pixelMin.x)
+    {
+        return; // no point in front of the camera
+    }
+    cv::Rect pixelExtent(pixelMin, pixelMax + cv::Point(1, 1));
+
+    // shrink all bounding boxes once to avoid having too many outlier points around the edges
+    vector<cv::Rect> smallerBoxes;
+    vector<int> boxIdx; // index into boundingBoxes for each non-empty shrunk box
+    cv::Point gridMin(INT_MAX, INT_MAX), gridMax(INT_MIN, INT_MIN);
+    for (size_t k = 0; k < boundingBoxes.size(); ++k)
+    {
+        const cv::Rect &roi = boundingBoxes[k].roi;
+        cv::Rect smallerBox;
+        smallerBox.x = roi.x + shrinkFactor * roi.width / 2.0;
+        smallerBox.y = roi.y + shrinkFactor * roi.height / 2.0;
+        smallerBox.width = roi.width * (1 - shrinkFactor);
+        smallerBox.height = roi.height * (1 - shrinkFactor);
+        smallerBox &= pixelExtent; // does not change which points a box contains, but bounds the grid
+        if (smallerBox.width <= 0 || smallerBox.height <= 0)
+        {
+            continue; // cannot contain any point
+        }
+
+        smallerBoxes.push_back(smallerBox);
+        boxIdx.push_back((int)k);
+        gridMin.x = min(gridMin.x, smallerBox.x);
+        gridMin.y = min(gridMin.y, smallerBox.y);
+        gridMax.x = max(gridMax.x, smallerBox.x + smallerBox.width - 1);
+        gridMax.y = max(gridMax.y, smallerBox.y + smallerBox.height - 1);
+    }
+    if (smallerBoxes.empty())
+    {
+        return;
+    }
+
+    // bucket grid over the area covered by the boxes: each cell lists the boxes overlapping it (compressed row storage)
+    const int cellSize = 32; // in [px]
+    int gridCols = (gridMax.x - gridMin.x) / cellSize + 1;
+    int gridRows = (gridMax.y - gridMin.y) / cellSize + 1;
+    vector<int> pairCells, pairBoxes; // one (cell, box) pair for each cell a box overlaps
+    for (size_t b = 0; b < smallerBoxes.size(); ++b)
+    {
+        const cv::Rect &box = smallerBoxes[b];
+        for (int r = (box.y - gridMin.y) / cellSize; r <= (box.y + box.height - 1 - gridMin.y) / cellSize; ++r)
+        {
+            for (int c = (box.x - gridMin.x) / cellSize; c <= (box.x + box.width - 1 - gridMin.x) / cellSize; ++c)
             {
-                enclosingBoxes.push_back(it2);
+                pairCells.push_back(r * gridCols + c);
+                pairBoxes.push_back((int)b);
             }
+        }
+    }
+    BucketGrid grid;
+    grid.build(pairCells, gridCols * gridRows);
+
+    // loop over all Lidar points and associate them to a 2D bounding box
+    for (size_t i = 0; i < lidarPoints.size(); ++i)
+    {
+        if (!pixels[i].bInFront)
+        {
+            continue; // point is behind the camera and cannot be inside any box
+        }
+        const cv::Point &pt = pixels[i].pt; // pixel coordinates
+        if (pt.x < gridMin.x || pt.x > gridMax.x || pt.y < gridMin.y || pt.y > gridMax.y)
+        {
+            continue;
+        }
 
-        } // eof loop over all bounding boxes
+        // only the boxes overlapping the cell of the point can enclose it
+        int cell = ((pt.y - gridMin.y) / cellSize) * gridCols + (pt.x - gridMin.x) / cellSize;
+        int nEnclosing = 0, enclosingBox = -1;
+        for (int j = grid.start[cell]; j < grid.start[cell + 1]; ++j)
+        {
+            int b = pairBoxes[grid.items[j]];
+            if (smallerBoxes[b].contains(pt))
+            {
+                nEnclosing++;
+                enclosingBox = b;
+            }
+        }
 
         // check wether point has been enclosed by one or by multiple boxes
-        if (enclosingBoxes.size() == 1)
+        if (nEnclosing == 1)
         { 
             // add Lidar point to bounding box
-            enclosingBoxes[0]->lidarPoints.push_back(*it1);
+            boundingBoxes[boxIdx[enclosingBox]].lidarPoints.push_back(lidarPoints[i]);
+            if (pointBoxes != nullptr)
+            {
+                (*pointBoxes)[i] = boxIdx[enclosingBox];
+            }
         }
 
     } // eof loop over all Lidar points
@@ -133,8 +214,95 @@ void show3DObjects(std::vector<BoundingBox> &boundingBoxes, cv::Size worldSize,
     }
 }
 
+// distance ratios of all matched keypoint pairs whose distance in the current frame lies within [100, 160] px; candidate pairs are
+// generated from a grid with cells slightly larger than 160 px, so only the neighbouring cells of each keypoint are visited. The result holds the
+// same values as the all-pairs reference below (each pair appears twice unless it involves the first or the last match)
 void getKeyPointDistanceRatios(std::vector<cv::KeyPoint> &kptsPrev, std::vector<cv::KeyPoint> &kptsCurr, std::vector<cv::DMatch> &kptMatches, vector<double> &distRatios)
 {
+    const double minDist = 100.0; // min. required distance
+    const double maxDist = 160.0;
+    const float cellSize = 161.f; // > maxDist, so all partners within maxDist are in the 3x3 neighbourhood despite rounding
+    int n = (int)kptMatches.size();
+    if (n < 2)
+    {
+        return;
+    }
+
+    // packed keypoint positions of both frames
+    vector<float> xPrev(n), yPrev(n), xCurr(n), yCurr(n);
+    float minX = 1e8, minY = 1e8, maxX = -1e8, maxY = -1e8;
+    for (int i = 0; i < n; ++i)
+    {
+        const cv::Point2f &ptPrev = kptsPrev[kptMatches[i].queryIdx].pt;
+        const cv::Point2f &ptCurr = kptsCurr[kptMatches[i].trainIdx].pt;
+        xPrev[i] = ptPrev.x; yPrev[i] = ptPrev.y;
+        xCurr[i] = ptCurr.x; yCurr[i] = ptCurr.y;
+        minX = min(minX, ptCurr.x); maxX = max(maxX, ptCurr.x);
+        minY = min(minY, ptCurr.y); maxY = max(maxY, ptCurr.y);
+    }
+
+    // sort the matches into grid cells by their position in the current frame (compressed row storage)
+    int cols = (int)((maxX - minX) / cellSize) + 1;
+    int rows = (int)((maxY - minY) / cellSize) + 1;
+    vector<int> pointCell(n);
+    for (int i = 0; i < n; ++i)
+    {
+        int c = min((int)((xCurr[i] - minX) / cellSize), cols - 1);
+        int r = min((int)((yCurr[i] - minY) / cellSize), rows - 1);
+        pointCell[i] = r * cols + c;
+    }
+    BucketGrid grid;
+    grid.build(pointCell, rows * cols);
+
+    // visit each unordered pair {a, b} with a < b once
+    for (int a = 0; a < n; ++a)
+    {
+        int r0 = pointCell[a] / cols, c0 = pointCell[a] % cols;
+        for (int r = max(r0 - 1, 0); r <= min(r0 + 1, rows - 1); ++r)
+        {
+            for (int c = max(c0 - 1, 0); c <= min(c0 + 1, cols - 1); ++c)
+            {
+                int cell = r * cols + c;
+                for (int j = grid.start[cell]; j < grid.start[cell + 1]; ++j)
+                {
+                    int b = grid.items[j];
+                    if (b <= a)
+                    {
+                        continue;
+                    }
+
+                    // same arithmetic as cv::norm(pt1 - pt2): float differences, double square root
+                    float dxCurr = xCurr[a] - xCurr[b], dyCurr = yCurr[a] - yCurr[b];
+                    double distCurr = std::sqrt((double)dxCurr * dxCurr + (double)dyCurr * dyCurr);
+                    if (distCurr < minDist || distCurr > maxDist)
+                    {
+                        continue;
+                    }
+                    float dxPrev = xPrev[a] - xPrev[b], dyPrev = yPrev[a] - yPrev[b];
+                    double distPrev = std::sqrt((double)dxPrev * dxPrev + (double)dyPrev * dyPrev);
+                    if (distPrev > std::numeric_limits<double>::epsilon())
+                    { // avoid division by zero
+                        double distRatio = distCurr / distPrev;
+                        distRatios.push_back(distRatio);
+                        // the reference loop sees the pair a second time as (b, a) unless a is the first or b the last match
+                        if (a > 0 && b < n - 1)
+                        {
+                            distRatios.push_back(distRatio);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+// reference implementation looping over all pairs of matches (kept for benchmarking)
+void getKeyPointDistanceRatiosAllPairs(std::vector<cv::KeyPoint> &kptsPrev, std::vector<cv::KeyPoint> &kptsCurr, std::vector<cv::DMatch> &kptMatches, vector<double> &distRatios)
+{
+    if (kptMatches.size() == 0)
+    {
+        return;
+    }
     // compute distance ratios between all matched keypoints
     for (auto it1 = kptMatches.begin(); it1 != kptMatches.end() - 1; ++it1)
     { // outer kpt. loop
@@ -221,7 +389,7 @@ void clusterKptMatchesWithROI(BoundingBox &boundingBox, std::vector<cv::KeyPoint
 
 // Compute time-to-collision (TTC) based on keypoint correspondences in successive images
 void computeTTCCamera(std::vector<cv::KeyPoint> &kptsPrev, std::vector<cv::KeyPoint> &kptsCurr, 
-                      std::vector<cv::DMatch> kptMatches, double frameRate, double &TTC, cv::Mat *visImg)
+                      std::vector<cv::DMatch> &kptMatches, double frameRate, double &TTC, cv::Mat *visImg)
 {
     // ...
     vector<double> distRatios; // stores the distance ratios for all keypoints between curr. and prev. frame    
@@ -245,91 +413,329 @@ void computeTTCCamera(std::vector<cv::KeyPoint> &kptsPrev, std::vector<cv::KeyPo
     // STUDENT TASK (replacement for meanDistRatio)
 }
 
-double getMedianFromVector(vector<double> vec, int start, int end)
+CameraTTCEstimate computeTTCCameraSampled(std::vector<cv::KeyPoint> &kptsPrev, std::vector<cv::KeyPoint> &kptsCurr, std::vector<cv::DMatch> &kptMatches,
+                                          double frameRate, double ttcTolerance, int maxPairs, int batchSize)
+{
+    const double minDist = 100.0; // same distance band as getKeyPointDistanceRatios
+    const double maxDist = 160.0;
+    const double z = 1.96;        // two-sided 95% interval
+    const int maxAttemptsPerPair = 50; // gives up on boxes where (almost) no pair falls into the band
+
+    CameraTTCEstimate estimate;
+    estimate.ttc = NAN;
+    estimate.nPairs = 0;
+    estimate.ttcLow = -std::numeric_limits<double>::infinity();
+    estimate.ttcHigh = std::numeric_limits<double>::infinity();
+
+    int n = (int)kptMatches.size();
+    if (n < 2)
+    {
+        return estimate;
+    }
+
+    double dT = 1 / frameRate;
+    cv::RNG rng(0x5eed);
+    vector<double> distRatios;
+    distRatios.reserve(maxPairs);
+    long attempts = 0, maxAttempts = (long)maxPairs * maxAttemptsPerPair;
+    while ((int)distRatios.size() < maxPairs && attempts < maxAttempts)
+    {
+        // draw the next batch of pairs in the distance band
+        int batchEnd = min((int)distRatios.size() + batchSize, maxPairs);
+        while ((int)distRatios.size() < batchEnd && attempts < maxAttempts)
+        {
+            attempts++;
+            int a = rng.uniform(0, n), b = rng.uniform(0, n);
+            if (a == b)
+            {
+                continue;
+            }
+            const cv::Point2f &ptCurrA = kptsCurr[kptMatches[a].trainIdx].pt, &ptCurrB = kptsCurr[kptMatches[b].trainIdx].pt;
+            double distCurr = cv::norm(ptCurrA - ptCurrB);
+            if (distCurr < minDist || distCurr > maxDist)
+            {
+                continue;
+            }
+            double distPrev = cv::norm(kptsPrev[kptMatches[a].queryIdx].pt - kptsPrev[kptMatches[b].queryIdx].pt);
+            if (distPrev > std::numeric_limits<double>::epsilon())
+            {
+                distRatios.push_back(distCurr / distPrev);
+            }
+        }
+
+        int m = (int)distRatios.size();
+        if (m == 0)
+        {
+            continue;
+        }
+
+        // median and its confidence interval from the order statistics at m/2 -+ z*sqrt(m)/2
+        double *first = distRatios.data(), *last = distRatios.data() + m;
+        double medianRatio = getMedianInPlace(first, last);
+        int kLow = max((int)floor(m / 2.0 - z * sqrt((double)m) / 2.0), 0);
+        int kHigh = min((int)ceil(m / 2.0 + z * sqrt((double)m) / 2.0), m - 1);
+        nth_element(first, first + kLow, last);
+        double ratioLow = first[kLow];
+        nth_element(first + kLow, first + kHigh, last);
+        double ratioHigh = first[kHigh];
+
+        estimate.ttc = -dT / (1 - medianRatio);
+        estimate.nPairs = m;
+        if (ratioLow <= 1.0 && ratioHigh >= 1.0)
+        {
+            // the interval includes a static scene, TTC is unbounded
+            estimate.ttcLow = -std::numeric_limits<double>::infinity();
+            estimate.ttcHigh = std::numeric_limits<double>::infinity();
+            continue;
+        }
+
+        // TTC is monotonic in the ratio on either side of 1
+        double ttc1 = -dT / (1 - ratioLow), ttc2 = -dT / (1 - ratioHigh);
+        estimate.ttcLow = min(ttc1, ttc2);
+        estimate.ttcHigh = max(ttc1, ttc2);
+        if (estimate.ttcHigh - estimate.ttcLow < ttcTolerance)
+        {
+            break;
+        }
+    }
+    return estimate;
+}
+
+double getMedianInPlace(double *first, double *last)
 {
-    std::sort(vec.begin(), vec.end());
-    int size = end - start + 1;
-    int mid = start + (end - start) / 2;
-    double median = 0.0;
+    ptrdiff_t size = last - first;
+    if (size <= 0)
+    {
+        return NAN;
+    }
+    double *mid = first + size / 2;
+    nth_element(first, mid, last);
     if (size % 2 == 1)
     {
-        median =  vec[mid];
+        return *mid;
     }
-    else
+    // for an even size the lower middle element is the largest one in front of mid
+    return (*max_element(first, mid) + *mid) / 2.0;
+}
+
+double getQuantileInPlace(double *first, double *last, double q)
+{
+    ptrdiff_t size = last - first;
+    if (size <= 0)
+    {
+        return NAN;
+    }
+    double h = min(max(q, 0.0), 1.0) * (size - 1);
+    ptrdiff_t k = (ptrdiff_t)h;
+    nth_element(first, first + k, last);
+    double lower = first[k];
+    if (k + 1 >= size || h == k)
     {
-        median = (vec[mid] + vec[mid-1]) / 2;
+        return lower;
     }
-    return median;
+    // the next order statistic is the smallest element behind k
+    double upper = *min_element(first + k + 1, last);
+    return lower + (h - k) * (upper - lower);
 }
 
+double getIQRInPlace(double *first, double *last)
+{
+    double q3 = getQuantileInPlace(first, last, 0.75);
+    double q1 = getQuantileInPlace(first, last, 0.25);
+    return q3 - q1;
+}
 
-float getMedianFromQueue(priority_queue<float> q)
+double getMedianFromVector(vector<double> &vec, int start, int end)
 {
-    // if (q.size() == 0)
-    //     // throw exception?
-    int mid = int(q.size() / 2);
-    int i = 0;
-    while (i < mid)
+    return getMedianInPlace(vec.data() + start, vec.data() + end + 1);
+}
+
+P2Quantile::P2Quantile(double q) : p(q), n(0)
+{
+}
+
+void P2Quantile::add(double x)
+{
+    // the first five values initialize the markers
+    if (n < 5)
+    {
+        heights[n++] = x;
+        if (n == 5)
+        {
+            sort(heights, heights + 5);
+            for (int i = 0; i < 5; ++i)
+            {
+                positions[i] = i + 1;
+            }
+            desired[0] = 1; desired[1] = 1 + 2 * p; desired[2] = 1 + 4 * p; desired[3] = 3 + 2 * p; desired[4] = 5;
+            increments[0] = 0; increments[1] = p / 2; increments[2] = p; increments[3] = (1 + p) / 2; increments[4] = 1;
+        }
+        return;
+    }
+
+    // find the cell heights[k] <= x < heights[k+1], extending the extreme markers if necessary
+    int k;
+    if (x < heights[0])
     {
-        q.pop();
-        i ++;
+        heights[0] = x;
+        k = 0;
     }
-    float result;
-    if (q.size() % 2 == 0)
+    else if (x >= heights[4])
     {
-        float p1 = q.top();
-        q.pop();
-        float p2 = q.top();
-        result = (p1 + p2) / 2.0;
+        heights[4] = x;
+        k = 3;
     }
     else
     {
-        result = q.top();
+        k = 0;
+        while (x >= heights[k + 1])
+        {
+            k++;
+        }
+    }
+
+    for (int i = k + 1; i < 5; ++i)
+    {
+        positions[i] += 1;
+    }
+    for (int i = 0; i < 5; ++i)
+    {
+        desired[i] += increments[i];
+    }
+    n++;
+
+    // move the middle markers towards their desired positions
+    for (int i = 1; i < 4; ++i)
+    {
+        double delta = desired[i] - positions[i];
+        if ((delta >= 1 && positions[i + 1] - positions[i] > 1) || (delta <= -1 && positions[i - 1] - positions[i] < -1))
+        {
+            int d = delta >= 0 ? 1 : -1;
+            double h = parabolic(i, d);
+            heights[i] = (heights[i - 1] < h && h < heights[i + 1]) ? h : linear(i, d);
+            positions[i] += d;
+        }
+    }
+}
+
+double P2Quantile::parabolic(int i, int d) const
+{
+    return heights[i] + d / (positions[i + 1] - positions[i - 1]) *
+                            ((positions[i] - positions[i - 1] + d) * (heights[i + 1] - heights[i]) / (positions[i + 1] - positions[i]) +
+                             (positions[i + 1] - positions[i] - d) * (heights[i] - heights[i - 1]) / (positions[i] - positions[i - 1]));
+}
+
+double P2Quantile::linear(int i, int d) const
+{
+    return heights[i] + d * (heights[i + d] - heights[i]) / (positions[i + d] - positions[i]);
+}
+
+double P2Quantile::value() const
+{
+    if (n >= 5)
+    {
+        return heights[2];
+    }
+    double values[5];
+    copy(heights, heights + n, values);
+    return getQuantileInPlace(values, values + n, p);
+}
+
+// keeps the n smallest x values of the Lidar points in ascending order in smallest[] and returns how many were found
+static int getSmallestX(const std::vector<LidarPoint> &lidarPoints, double *smallest, int n)
+{
+    int count = 0;
+    for (auto it = lidarPoints.begin(); it != lidarPoints.end(); ++it)
+    {
+        double xw = it->x;
+        if (count == n && xw >= smallest[n - 1])
+        {
+            continue;
+        }
+        int pos = count < n ? count++ : n - 1;
+        while (pos > 0 && smallest[pos - 1] > xw)
+        {
+            smallest[pos] = smallest[pos - 1];
+            pos--;
+        }
+        smallest[pos] = xw;
     }
-    return result;
+    return count;
 }
 
 void computeTTCLidar(std::vector<LidarPoint> &lidarPointsPrev,
                      std::vector<LidarPoint> &lidarPointsCurr, double frameRate, double &TTC)
 {
-    // ...
+    // median of the 5 closest points of each frame, found in a fixed array instead of a heap
     bool useMedian = true;
-    priority_queue <float> prevMinXQueue;
-    priority_queue <float> currMinXQueue;
-    float prevxwMin = 1e8, currxwMin = 1e8;
-    float prevMinXValueRobust, currMinXValueRobust;
-    int queue_size = 5;
-    for (auto it1 = lidarPointsPrev.begin(); it1 != lidarPointsPrev.end(); ++it1)
+    const int nClosest = 5;
+    double prevClosest[nClosest], currClosest[nClosest];
+    int nPrev = getSmallestX(lidarPointsPrev, prevClosest, nClosest);
+    int nCurr = getSmallestX(lidarPointsCurr, currClosest, nClosest);
+    if (nPrev == 0 || nCurr == 0)
     {
-        float xw = (*it1).x;
-        prevxwMin = prevxwMin < xw ? prevxwMin : xw;
-        prevMinXQueue.push(xw);
-        if (prevMinXQueue.size() > queue_size)
-            prevMinXQueue.pop();
+        TTC = NAN;
+        return;
     }
 
-    for (auto it2 = lidarPointsCurr.begin(); it2 != lidarPointsCurr.end(); ++it2)
+    double prevMinXValueRobust, currMinXValueRobust;
+    if (useMedian)
     {
-        float xw = (*it2).x;
-        currxwMin = currxwMin < xw ? currxwMin : xw;
-        currMinXQueue.push(xw);
-        if (currMinXQueue.size() > queue_size)
-            currMinXQueue.pop();
+        prevMinXValueRobust = getMedianInPlace(prevClosest, prevClosest + nPrev);
+        currMinXValueRobust = getMedianInPlace(currClosest, currClosest + nCurr);
     }
+    else
+    {
+        prevMinXValueRobust = prevClosest[0];
+        currMinXValueRobust = currClosest[0];
+    }
+    double dT = 1 / frameRate;
+    TTC = currMinXValueRobust * dT / (prevMinXValueRobust - currMinXValueRobust);
+    // cout << useMedian << ", " << nClosest << ", " << frameRate << ", " << prevMinXValueRobust << ", " << currMinXValueRobust << ", "<< TTC << endl;
+}
 
-    if (useMedian)
+// closest distance in x of the largest Euclidean cluster of the Lidar points in the box, which drops isolated returns
+// (spray, road, neighbouring objects) instead of averaging over the 5 closest points; the result is cached on the box
+double getLidarMinX(BoundingBox &boundingBox, double clusterTolerance, int minClusterSize)
+{
+    if (boundingBox.bLidarMinX)
     {
-        prevMinXValueRobust = getMedianFromQueue(prevMinXQueue);
-        currMinXValueRobust = getMedianFromQueue(currMinXQueue);
+        return boundingBox.lidarMinX;
+    }
+
+    vector<vector<int>> clusters;
+    euclideanClusterLidar(boundingBox.lidarPoints, clusterTolerance, minClusterSize, clusters);
+
+    double minX = 1e8;
+    if (clusters.size() > 0)
+    {
+        for (int idx : clusters[0])
+        {
+            minX = min(minX, boundingBox.lidarPoints[idx].x);
+        }
     }
     else
     {
-        prevMinXValueRobust = prevxwMin;
-        currMinXValueRobust = currxwMin;
+        // no cluster is large enough, fall back to the closest point
+        for (auto it = boundingBox.lidarPoints.begin(); it != boundingBox.lidarPoints.end(); ++it)
+        {
+            minX = min(minX, it->x);
+        }
     }
+
+    boundingBox.lidarMinX = minX;
+    boundingBox.bLidarMinX = true;
+    return minX;
+}
+
+// same as above based on the dominant Lidar cluster of both boxes, the previous box has usually been evaluated in the last frame
+void computeTTCLidar(BoundingBox &prevBB, BoundingBox &currBB, double frameRate, double &TTC)
+{
+    double prevMinX = getLidarMinX(prevBB);
+    double currMinX = getLidarMinX(currBB);
+
     double dT = 1 / frameRate;
-    TTC = currMinXValueRobust * dT / (prevMinXValueRobust - currMinXValueRobust);
-    // cout << useMedian << ", " << queue_size << ", " << frameRate << ", " << prevMinXValueRobust << ", " << currMinXValueRobust << ", "<< TTC << endl;
+    TTC = currMinX * dT / (prevMinX - currMinX);
 }
 
 
@@ -413,3 +819,147 @@ void matchBoundingBoxes(std::vector<cv::DMatch> &matches, std::map<int, int> &bb
     }
 
 }
+
+
+// move the bounding boxes of the previous frame into the current frame using the keypoint matches enclosed by each box;
+// returns false if at least one box was supported by fewer than minKptMatches matches (tracking confidence is low)
+bool propagateBoundingBoxes(std::vector<cv::DMatch> &matches, DataFrame &prevFrame, DataFrame &currFrame, int minKptMatches)
+{
+    bool bConfident = true;
+    currFrame.boundingBoxes.clear();
+    for (auto it1 = prevFrame.boundingBoxes.begin(); it1 != prevFrame.boundingBoxes.end(); ++it1)
+    {
+        // keep id, class and confidence so that boxes can be associated with the previous frame as usual
+        BoundingBox bBox;
+        bBox.boxID = it1->boxID;
+        bBox.trackID = it1->trackID;
+        bBox.classID = it1->classID;
+        bBox.confidence = it1->confidence;
+        bBox.roi = it1->roi;
+
+        vector<cv::Point2f> prevPts, currPts;
+        for (cv::DMatch match: matches)
+        {
+            const cv::KeyPoint &prevKpt = prevFrame.keypoints.at(match.queryIdx);
+            if (it1->roi.contains(prevKpt.pt))
+            {
+                prevPts.push_back(prevKpt.pt);
+                currPts.push_back(currFrame.keypoints.at(match.trainIdx).pt);
+            }
+        }
+
+        if ((int)prevPts.size() < minKptMatches)
+        {
+            bConfident = false;
+        }
+
+        if (prevPts.size() > 0)
+        {
+            // median position of the matched keypoints in both frames gives the displacement of the box
+            vector<double> xPrev, yPrev, xCurr, yCurr;
+            for (size_t i = 0; i < prevPts.size(); ++i)
+            {
+                xPrev.push_back(prevPts[i].x); yPrev.push_back(prevPts[i].y);
+                xCurr.push_back(currPts[i].x); yCurr.push_back(currPts[i].y);
+            }
+            int last = (int)prevPts.size() - 1;
+            cv::Point2d centerPrev(getMedianFromVector(xPrev, 0, last), getMedianFromVector(yPrev, 0, last));
+            cv::Point2d centerCurr(getMedianFromVector(xCurr, 0, last), getMedianFromVector(yCurr, 0, last));
+
+            // median ratio of keypoint distances to the center gives the scale change of the box
+            vector<double> scaleRatios;
+            for (size_t i = 0; i < prevPts.size(); ++i)
+            {
+                double distPrev = cv::norm(cv::Point2d(prevPts[i]) - centerPrev);
+                double distCurr = cv::norm(cv::Point2d(currPts[i]) - centerCurr);
+                if (distPrev > 1.0)
+                {
+                    scaleRatios.push_back(distCurr / distPrev);
+                }
+            }
+            double scale = scaleRatios.size() > 0 ? getMedianFromVector(scaleRatios, 0, scaleRatios.size() - 1) : 1.0;
+
+            bBox.roi.x = cvRound(centerCurr.x + scale * (it1->roi.x - centerPrev.x));
+            bBox.roi.y = cvRound(centerCurr.y + scale * (it1->roi.y - centerPrev.y));
+            bBox.roi.width = cvRound(scale * it1->roi.width);
+            bBox.roi.height = cvRound(scale * it1->roi.height);
+
+            // a poor scale estimate from few matches must not push the box far outside the frame
+            bBox.roi &= cv::Rect(0, 0, currFrame.cameraImg.cols, currFrame.cameraImg.rows);
+        }
+
+        currFrame.boundingBoxes.push_back(bBox);
+    }
+    return bConfident;
+}
+
+
+// median displacement of the matched keypoints from the previous to the current frame (x and y separately)
+cv::Point2f getMedianFlow(std::vector<cv::KeyPoint> &kptsPrev, std::vector<cv::KeyPoint> &kptsCurr, std::vector<cv::DMatch> &kptMatches)
+{
+    if (kptMatches.size() == 0)
+    {
+        return cv::Point2f(0, 0);
+    }
+    vector<double> dx, dy;
+    dx.reserve(kptMatches.size());
+    dy.reserve(kptMatches.size());
+    for (auto it = kptMatches.begin(); it != kptMatches.end(); ++it)
+    {
+        cv::Point2f d = kptsCurr[it->trainIdx].pt - kptsPrev[it->queryIdx].pt;
+        dx.push_back(d.x);
+        dy.push_back(d.y);
+    }
+    return cv::Point2f(getMedianInPlace(dx.data(), dx.data() + dx.size()), getMedianInPlace(dy.data(), dy.data() + dy.size()));
+}
+
+// displacement of the roi center for all boxes of the current frame which are matched with a box of the previous frame
+void computeBoxFlows(DataFrame &prevFrame, DataFrame &currFrame)
+{
+    for (auto it = currFrame.bbMatches.begin(); it != currFrame.bbMatches.end(); ++it)
+    {
+        BoundingBox *prevBB = nullptr, *currBB = nullptr;
+        for (auto it2 = prevFrame.boundingBoxes.begin(); it2 != prevFrame.boundingBoxes.end(); ++it2)
+        {
+            if (it2->boxID == it->first)
+            {
+                prevBB = &(*it2);
+            }
+        }
+        for (auto it2 = currFrame.boundingBoxes.begin(); it2 != currFrame.boundingBoxes.end(); ++it2)
+        {
+            if (it2->boxID == it->second)
+            {
+                currBB = &(*it2);
+            }
+        }
+        if (prevBB != nullptr && currBB != nullptr)
+        {
+            cv::Point2f centerPrev(prevBB->roi.x + prevBB->roi.width / 2.f, prevBB->roi.y + prevBB->roi.height / 2.f);
+            cv::Point2f centerCurr(currBB->roi.x + currBB->roi.width / 2.f, currBB->roi.y + currBB->roi.height / 2.f);
+            currBB->flow = centerCurr - centerPrev;
+            currBB->bFlow = true;
+        }
+    }
+}
+
+// expected position of each keypoint of frame in the next frame assuming constant motion: the flow of the first enclosing
+// box which has one, the median flow of the frame otherwise
+void predictKeypointPositions(const DataFrame &frame, std::vector<cv::Point2f> &predicted)
+{
+    predicted.resize(frame.keypoints.size());
+    for (size_t i = 0; i < frame.keypoints.size(); ++i)
+    {
+        const cv::Point2f &pt = frame.keypoints[i].pt;
+        cv::Point2f flow = frame.medianFlow;
+        for (auto it = frame.boundingBoxes.begin(); it != frame.boundingBoxes.end(); ++it)
+        {
+            if (it->bFlow && it->roi.contains(pt))
+            {
+                flow = it->flow;
+                break;
+            }
+        }
+        predicted[i] = pt + flow;
+    }
+}
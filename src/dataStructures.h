@@ -4,8 +4,53 @@
 
 #include <vector>
 #include <map>
+#include <memory>
 #include <opencv2/core.hpp>
 
+// std::vector allocator returning memory aligned for SIMD loads (cv::fastMalloc aligns to CV_MALLOC_ALIGN bytes)
+template <typename T>
+struct AlignedAllocator
+{
+    typedef T value_type;
+
+    AlignedAllocator() {}
+    template <typename U> AlignedAllocator(const AlignedAllocator<U> &) {}
+
+    T *allocate(size_t n) { return (T *)cv::fastMalloc(n * sizeof(T)); }
+    void deallocate(T *p, size_t) { cv::fastFree(p); }
+};
+template <typename T, typename U> bool operator==(const AlignedAllocator<T> &, const AlignedAllocator<U> &) { return true; }
+template <typename T, typename U> bool operator!=(const AlignedAllocator<T> &, const AlignedAllocator<U> &) { return false; }
+
+// items (points, boxes, descriptor rows) sorted into buckets (grid cells, hash keys) in compressed row storage: the items of
+// bucket b are items[start[b]] ... items[start[b + 1] - 1] in increasing order, built by a counting sort from the bucket of each item
+struct BucketGrid
+{
+    std::vector<int> start; // (nBuckets + 1) offsets into items
+    std::vector<int> items; // item indices sorted by bucket
+
+    void build(const std::vector<int> &itemBuckets, int nBuckets)
+    {
+        start.assign(nBuckets + 1, 0);
+        for (size_t i = 0; i < itemBuckets.size(); ++i)
+        {
+            start[itemBuckets[i] + 1]++;
+        }
+        for (int b = 1; b <= nBuckets; ++b)
+        {
+            start[b] += start[b - 1];
+        }
+        items.resize(itemBuckets.size());
+        std::vector<int> fill(start.begin(), start.end() - 1); // next free slot of each bucket
+        for (size_t i = 0; i < itemBuckets.size(); ++i)
+        {
+            items[fill[itemBuckets[i]]++] = (int)i;
+        }
+    }
+};
+
+class BinaryLshIndex;
+
 struct LidarPoint { // single lidar point in space
     double x,y,z,r; // x,y,z in [m], r is point reflectivity
 };
@@ -22,6 +67,12 @@ struct BoundingBox { // bounding box around a classified object (contains both 2
     std::vector<LidarPoint> lidarPoints; // Lidar 3D points which project into 2D image roi
     std::vector<cv::KeyPoint> keypoints; // keypoints enclosed by 2D roi
     std::vector<cv::DMatch> kptMatches; // keypoint matches enclosed by 2D roi
+
+    bool bLidarMinX = false; // true once lidarMinX has been computed, so that the next frame can reuse it
+    double lidarMinX;        // closest distance in x [m] of the dominant Lidar cluster within the box
+
+    bool bFlow = false;      // true if the box has been matched with a box of the previous frame
+    cv::Point2f flow;        // displacement of the roi center since the previous frame
 };
 
 struct DataFrame { // represents the available sensor information at the same time instance
@@ -30,7 +81,9 @@ struct DataFrame { // represents the available sensor information at the same ti
     
     std::vector<cv::KeyPoint> keypoints; // 2D keypoints within camera image
     cv::Mat descriptors; // keypoint descriptors
+    std::shared_ptr<BinaryLshIndex> lshIndex; // LSH index over the descriptors (MAT_LSH only), built once and reused while this frame is the previous one
     std::vector<cv::DMatch> kptMatches; // keypoint matches between previous and current frame
+    cv::Point2f medianFlow = cv::Point2f(0, 0); // median keypoint displacement between previous and current frame
     std::vector<LidarPoint> lidarPoints;
 
     std::vector<BoundingBox> boundingBoxes; // ROI around detected objects in 2D image coordinates
@@ -0,0 +1,83 @@
+
+#include <iostream>
+#include <algorithm>
+
+#include "featureTracks.hpp"
+
+
+using namespace std;
+
+FeatureTrackStore::FeatureTrackStore(int maxFrames) : slots(max(maxFrames, 2)), newest(-1), nFrames(0), nextTrackId(0)
+{
+}
+
+void FeatureTrackStore::addFrame(const std::vector<cv::KeyPoint> &keypoints, const std::vector<cv::DMatch> &matches)
+{
+    bool bHasPrev = nFrames > 0;
+    newest = (newest + 1) % slots.size();
+    nFrames = min(nFrames + 1, (int)slots.size());
+
+    // the oldest slot is overwritten, its buffers keep their capacity
+    FrameSlot &curr = slots[newest];
+    curr.keypoints.assign(keypoints.begin(), keypoints.end());
+    curr.prevIdx.assign(keypoints.size(), -1);
+    curr.trackIds.assign(keypoints.size(), -1);
+
+    if (bHasPrev)
+    {
+        const FrameSlot &prev = slot(1);
+        for (auto it = matches.begin(); it != matches.end(); ++it)
+        {
+            // a keypoint matched more than once continues the track of its first match
+            if (it->trainIdx >= 0 && it->trainIdx < (int)keypoints.size() && curr.prevIdx[it->trainIdx] < 0 &&
+                it->queryIdx >= 0 && it->queryIdx < (int)prev.keypoints.size())
+            {
+                curr.prevIdx[it->trainIdx] = it->queryIdx;
+                curr.trackIds[it->trainIdx] = prev.trackIds[it->queryIdx];
+            }
+        }
+    }
+
+    for (size_t i = 0; i < keypoints.size(); ++i)
+    {
+        if (curr.trackIds[i] < 0)
+        {
+            curr.trackIds[i] = nextTrackId++;
+        }
+    }
+}
+
+bool FeatureTrackStore::getCorrespondences(int k, std::vector<cv::KeyPoint> &kptsOld, std::vector<cv::KeyPoint> &kptsNew, std::vector<cv::DMatch> &matches) const
+{
+    kptsOld.clear();
+    kptsNew.clear();
+    matches.clear();
+    if (k < 1 || k >= nFrames)
+    {
+        return false;
+    }
+
+    const FrameSlot &newestSlot = slot(0), &oldSlot = slot(k);
+    kptsNew = newestSlot.keypoints;
+    kptsOld = oldSlot.keypoints;
+
+    // follow each track back k frames
+    for (size_t i = 0; i < newestSlot.keypoints.size(); ++i)
+    {
+        int idx = (int)i;
+        for (int back = 0; back < k && idx >= 0; ++back)
+        {
+            idx = slot(back).prevIdx[idx];
+        }
+        if (idx >= 0)
+        {
+            matches.push_back(cv::DMatch(idx, (int)i, 0.f));
+        }
+    }
+    return true;
+}
+
+int FeatureTrackStore::trackId(int keypointIdx) const
+{
+    return nFrames > 0 ? slot(0).trackIds[keypointIdx] : -1;
+}
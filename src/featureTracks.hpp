@@ -0,0 +1,44 @@
+
+#ifndef featureTracks_hpp
+#define featureTracks_hpp
+
+#include <stdio.h>
+#include <vector>
+#include <opencv2/core.hpp>
+
+// persistent keypoint tracks over the last maxFrames frames: a keypoint continues the track of the keypoint it has been matched
+// with in the previous frame and starts a new track otherwise. Frames are kept in a ring of maxFrames slots whose buffers are
+// reused, so memory is bounded and appending a match is O(1)
+class FeatureTrackStore
+{
+public:
+    explicit FeatureTrackStore(int maxFrames=5);
+
+    // appends a frame; matches link keypoints of the previously added frame (queryIdx) to the given keypoints (trainIdx)
+    void addFrame(const std::vector<cv::KeyPoint> &keypoints, const std::vector<cv::DMatch> &matches);
+
+    // correspondences between the frame k frames back and the newest frame along all tracks which span both frames,
+    // in the format of matchDescriptors (queryIdx into kptsOld, trainIdx into kptsNew); false if fewer than k+1 frames are stored
+    bool getCorrespondences(int k, std::vector<cv::KeyPoint> &kptsOld, std::vector<cv::KeyPoint> &kptsNew, std::vector<cv::DMatch> &matches) const;
+
+    int trackId(int keypointIdx) const;                       // id of the track of a keypoint of the newest frame
+    int frameCount() const { return nFrames; }                // no. of frames stored (at most maxFrames)
+    int maxFrames() const { return (int)slots.size(); }
+
+private:
+    struct FrameSlot
+    {
+        std::vector<cv::KeyPoint> keypoints;
+        std::vector<int> trackIds; // track of each keypoint
+        std::vector<int> prevIdx;  // keypoint of the same track in the previous frame, -1 if the track starts here
+    };
+
+    const FrameSlot &slot(int framesBack) const { return slots[(newest - framesBack + slots.size()) % slots.size()]; }
+
+    std::vector<FrameSlot> slots;
+    int newest;  // slot of the newest frame
+    int nFrames;
+    int nextTrackId;
+};
+
+#endif /* featureTracks_hpp */
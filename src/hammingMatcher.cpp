@@ -0,0 +1,377 @@
+
+#include <iostream>
+#include <algorithm>
+#include <climits>
+#include <cfloat>
+#include <cstring>
+#include <cmath>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#include <opencv2/core/hal/hal.hpp>
+
+#include "hammingMatcher.hpp"
+
+
+using namespace std;
+
+void PackedBinaryDescriptors::pack(const cv::Mat &descriptors)
+{
+    CV_Assert(descriptors.empty() || descriptors.depth() == CV_8U);
+    rows = descriptors.rows;
+    int bytesPerRow = (int)(descriptors.cols * descriptors.elemSize());
+    wordsPerRow = (bytesPerRow + 31) / 32 * 4;
+    data.assign((size_t)rows * wordsPerRow, 0);
+    for (int i = 0; i < rows; ++i)
+    {
+        memcpy(&data[(size_t)i * wordsPerRow], descriptors.ptr<uchar>(i), bytesPerRow);
+    }
+}
+
+#ifdef __AVX2__
+// per-byte popcount with a nibble lookup table (Mula et al.), summed into four 64-bit lanes
+static inline __m256i popcount256(__m256i v)
+{
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i lowMask = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_and_si256(v, lowMask);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), lowMask);
+    __m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+    return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+}
+
+int hammingDistance(const uint64_t *a, const uint64_t *b, int wordsPerRow)
+{
+    __m256i sum = _mm256_setzero_si256();
+    for (int w = 0; w < wordsPerRow; w += 4)
+    {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + w));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + w));
+        sum = _mm256_add_epi64(sum, popcount256(_mm256_xor_si256(va, vb)));
+    }
+    return (int)(_mm256_extract_epi64(sum, 0) + _mm256_extract_epi64(sum, 1) + _mm256_extract_epi64(sum, 2) + _mm256_extract_epi64(sum, 3));
+}
+#else
+int hammingDistance(const uint64_t *a, const uint64_t *b, int wordsPerRow)
+{
+    // OpenCV's vectorized popcount (universal intrinsics, dispatched to the instruction sets of the CPU at runtime)
+    return cv::hal::normHamming((const uchar *)a, (const uchar *)b, wordsPerRow * (int)sizeof(uint64_t));
+}
+#endif
+
+void hammingKnnMatch(const PackedBinaryDescriptors &query, const PackedBinaryDescriptors &train, std::vector<std::vector<cv::DMatch>> &knnMatches, int k)
+{
+    CV_Assert(k == 1 || k == 2);
+    CV_Assert(query.rows == 0 || train.rows == 0 || query.wordsPerRow == train.wordsPerRow);
+    knnMatches.assign(query.rows, vector<cv::DMatch>());
+    if (query.rows == 0 || train.rows == 0)
+    {
+        return;
+    }
+
+    const int queryBlock = 64;  // query rows per task
+    const int trainBlock = 256; // train rows per block, 16 KB of 64-byte descriptors stay in the L1 cache
+    int nQueryBlocks = (query.rows + queryBlock - 1) / queryBlock;
+    int wordsPerRow = query.wordsPerRow;
+
+    cv::parallel_for_(cv::Range(0, nQueryBlocks), [&](const cv::Range &range) {
+        int bestDist[queryBlock][2], bestIdx[queryBlock][2];
+        for (int qb = range.start; qb < range.end; ++qb)
+        {
+            int q0 = qb * queryBlock, q1 = min(q0 + queryBlock, query.rows);
+            for (int q = q0; q < q1; ++q)
+            {
+                bestDist[q - q0][0] = bestDist[q - q0][1] = INT_MAX;
+                bestIdx[q - q0][0] = bestIdx[q - q0][1] = -1;
+            }
+
+            // train rows are visited in increasing order, a candidate only displaces strictly worse ones
+            for (int t0 = 0; t0 < train.rows; t0 += trainBlock)
+            {
+                int t1 = min(t0 + trainBlock, train.rows);
+                for (int q = q0; q < q1; ++q)
+                {
+                    const uint64_t *qRow = query.row(q);
+                    int *dist = bestDist[q - q0], *idx = bestIdx[q - q0];
+                    for (int t = t0; t < t1; ++t)
+                    {
+                        int d = hammingDistance(qRow, train.row(t), wordsPerRow);
+                        if (d < dist[k - 1])
+                        {
+                            if (k == 2 && d < dist[0])
+                            {
+                                dist[1] = dist[0]; idx[1] = idx[0];
+                                dist[0] = d; idx[0] = t;
+                            }
+                            else
+                            {
+                                dist[k - 1] = d; idx[k - 1] = t;
+                            }
+                        }
+                    }
+                }
+            }
+
+            for (int q = q0; q < q1; ++q)
+            {
+                for (int j = 0; j < k; ++j)
+                {
+                    if (bestIdx[q - q0][j] >= 0)
+                    {
+                        knnMatches[q].push_back(cv::DMatch(q, bestIdx[q - q0][j], 0, (float)bestDist[q - q0][j]));
+                    }
+                }
+            }
+        }
+    });
+}
+
+BinaryLshIndex::BinaryLshIndex(int nTables, int keyBits, int multiProbeLevel)
+    : nTables(nTables), keyBits(keyBits), multiProbeLevel(multiProbeLevel)
+{
+    CV_Assert(nTables > 0 && keyBits > 0 && keyBits <= 24 && multiProbeLevel >= 0 && multiProbeLevel <= 2);
+
+    probeMasks.push_back(0);
+    for (int i = 0; i < keyBits && multiProbeLevel >= 1; ++i)
+    {
+        probeMasks.push_back(1u << i);
+    }
+    for (int i = 0; i < keyBits && multiProbeLevel >= 2; ++i)
+    {
+        for (int j = i + 1; j < keyBits; ++j)
+        {
+            probeMasks.push_back((1u << i) | (1u << j));
+        }
+    }
+}
+
+unsigned BinaryLshIndex::key(const uint64_t *row, int table) const
+{
+    unsigned k = 0;
+    const vector<int> &bits = keyBitPositions[table];
+    for (int i = 0; i < keyBits; ++i)
+    {
+        k |= (unsigned)((row[bits[i] >> 6] >> (bits[i] & 63)) & 1) << i;
+    }
+    return k;
+}
+
+void BinaryLshIndex::build(const cv::Mat &descriptors)
+{
+    this->descriptors.pack(descriptors);
+    int nBits = (int)(descriptors.cols * descriptors.elemSize() * 8);
+    int nBuckets = 1 << keyBits;
+
+    // same bit sampling for every frame, so that the tables of consecutive frames are comparable
+    cv::RNG rng(0x15a);
+    keyBitPositions.assign(nTables, vector<int>());
+    buckets.assign(nTables, BucketGrid());
+    if (nBits == 0)
+    {
+        return;
+    }
+    vector<int> allBits(nBits);
+    for (int b = 0; b < nBits; ++b)
+    {
+        allBits[b] = b;
+    }
+
+    vector<int> rowKeys(descriptors.rows);
+    for (int t = 0; t < nTables; ++t)
+    {
+        // partial Fisher-Yates shuffle picks keyBits distinct bits
+        for (int i = 0; i < min(keyBits, nBits); ++i)
+        {
+            swap(allBits[i], allBits[i + rng.uniform(0, nBits - i)]);
+            keyBitPositions[t].push_back(allBits[i]);
+        }
+        while ((int)keyBitPositions[t].size() < keyBits)
+        {
+            keyBitPositions[t].push_back(keyBitPositions[t][0]); // fewer descriptor bits than key bits
+        }
+
+        // counting sort of the rows by key
+        for (int r = 0; r < descriptors.rows; ++r)
+        {
+            rowKeys[r] = (int)key(this->descriptors.row(r), t);
+        }
+        buckets[t].build(rowKeys, nBuckets);
+    }
+}
+
+void BinaryLshIndex::knnMatch(const cv::Mat &queryDescriptors, std::vector<std::vector<cv::DMatch>> &knnMatches, int k) const
+{
+    CV_Assert(k == 1 || k == 2);
+    PackedBinaryDescriptors query(queryDescriptors);
+    knnMatches.assign(query.rows, vector<cv::DMatch>());
+    if (query.rows == 0 || descriptors.rows == 0)
+    {
+        return;
+    }
+    CV_Assert(query.wordsPerRow == descriptors.wordsPerRow);
+
+    cv::parallel_for_(cv::Range(0, query.rows), [&](const cv::Range &range) {
+        vector<int> visited(descriptors.rows, -1); // last query which has seen each row, avoids ranking a row twice
+        for (int q = range.start; q < range.end; ++q)
+        {
+            const uint64_t *qRow = query.row(q);
+            int dist[2] = {INT_MAX, INT_MAX}, idx[2] = {-1, -1};
+            for (int t = 0; t < nTables; ++t)
+            {
+                unsigned qKey = key(qRow, t);
+                for (unsigned mask : probeMasks)
+                {
+                    unsigned bucket = qKey ^ mask;
+                    for (int j = buckets[t].start[bucket]; j < buckets[t].start[bucket + 1]; ++j)
+                    {
+                        int r = buckets[t].items[j];
+                        if (visited[r] == q)
+                        {
+                            continue;
+                        }
+                        visited[r] = q;
+
+                        // candidates arrive in bucket order, so ties are resolved on the row index explicitly
+                        int d = hammingDistance(qRow, descriptors.row(r), descriptors.wordsPerRow);
+                        if (d < dist[k - 1] || (d == dist[k - 1] && r < idx[k - 1]))
+                        {
+                            if (k == 2 && (d < dist[0] || (d == dist[0] && r < idx[0])))
+                            {
+                                dist[1] = dist[0]; idx[1] = idx[0];
+                                dist[0] = d; idx[0] = r;
+                            }
+                            else
+                            {
+                                dist[k - 1] = d; idx[k - 1] = r;
+                            }
+                        }
+                    }
+                }
+            }
+
+            for (int j = 0; j < k; ++j)
+            {
+                if (idx[j] >= 0)
+                {
+                    knnMatches[q].push_back(cv::DMatch(q, idx[j], 0, (float)dist[j]));
+                }
+            }
+        }
+    });
+}
+
+double BinaryLshIndex::recall(const cv::Mat &queryDescriptors) const
+{
+    vector<vector<cv::DMatch>> lshMatches, bfMatches;
+    knnMatch(queryDescriptors, lshMatches, 1);
+    hammingKnnMatch(PackedBinaryDescriptors(queryDescriptors), descriptors, bfMatches, 1);
+
+    int nFound = 0, nQueries = 0;
+    for (size_t q = 0; q < bfMatches.size(); ++q)
+    {
+        if (bfMatches[q].size() > 0)
+        {
+            nQueries++;
+            nFound += lshMatches[q].size() > 0 && lshMatches[q][0].distance == bfMatches[q][0].distance;
+        }
+    }
+    return nQueries > 0 ? (double)nFound / nQueries : 1.0;
+}
+
+void guidedKnnMatch(const std::vector<cv::Point2f> &predicted, const cv::Mat &queryDescriptors, const std::vector<cv::KeyPoint> &trainKeypoints,
+                    const cv::Mat &trainDescriptors, float searchRadius, std::vector<std::vector<cv::DMatch>> &knnMatches, int k)
+{
+    CV_Assert(k == 1 || k == 2);
+    CV_Assert((int)predicted.size() == queryDescriptors.rows && (int)trainKeypoints.size() == trainDescriptors.rows);
+    knnMatches.assign(queryDescriptors.rows, vector<cv::DMatch>());
+    if (queryDescriptors.rows == 0 || trainDescriptors.rows == 0)
+    {
+        return;
+    }
+    CV_Assert(queryDescriptors.type() == trainDescriptors.type() && queryDescriptors.cols == trainDescriptors.cols);
+
+    // binary descriptors are compared in Hamming distance, floating point descriptors (SIFT) in L2 distance
+    bool bBinary = queryDescriptors.depth() == CV_8U;
+    CV_Assert(bBinary || queryDescriptors.type() == CV_32F);
+    PackedBinaryDescriptors query, train;
+    if (bBinary)
+    {
+        query.pack(queryDescriptors);
+        train.pack(trainDescriptors);
+    }
+
+    // grid over the train keypoints with cells of searchRadius px (compressed row storage)
+    float cellSize = max(searchRadius, 1.f);
+    float minX = 1e8, minY = 1e8, maxX = -1e8, maxY = -1e8;
+    for (auto it = trainKeypoints.begin(); it != trainKeypoints.end(); ++it)
+    {
+        minX = min(minX, it->pt.x); maxX = max(maxX, it->pt.x);
+        minY = min(minY, it->pt.y); maxY = max(maxY, it->pt.y);
+    }
+    int cols = (int)((maxX - minX) / cellSize) + 1;
+    int rows = (int)((maxY - minY) / cellSize) + 1;
+    vector<int> pointCell(trainKeypoints.size());
+    for (int i = 0; i < (int)trainKeypoints.size(); ++i)
+    {
+        int c = min((int)((trainKeypoints[i].pt.x - minX) / cellSize), cols - 1);
+        int r = min((int)((trainKeypoints[i].pt.y - minY) / cellSize), rows - 1);
+        pointCell[i] = r * cols + c;
+    }
+    BucketGrid grid;
+    grid.build(pointCell, rows * cols);
+
+    cv::parallel_for_(cv::Range(0, queryDescriptors.rows), [&](const cv::Range &range) {
+        for (int q = range.start; q < range.end; ++q)
+        {
+            const cv::Point2f &p = predicted[q];
+            int c0 = (int)floor((p.x - searchRadius - minX) / cellSize), c1 = (int)floor((p.x + searchRadius - minX) / cellSize);
+            int r0 = (int)floor((p.y - searchRadius - minY) / cellSize), r1 = (int)floor((p.y + searchRadius - minY) / cellSize);
+            c0 = max(c0, 0); c1 = min(c1, cols - 1);
+            r0 = max(r0, 0); r1 = min(r1, rows - 1);
+
+            float dist[2] = {FLT_MAX, FLT_MAX}; // squared distances in the L2 case
+            int idx[2] = {-1, -1};
+            for (int r = r0; r <= r1; ++r)
+            {
+                for (int c = c0; c <= c1; ++c)
+                {
+                    int cell = r * cols + c;
+                    for (int j = grid.start[cell]; j < grid.start[cell + 1]; ++j)
+                    {
+                        int t = grid.items[j];
+                        const cv::Point2f &pt = trainKeypoints[t].pt;
+                        if (fabs(pt.x - p.x) > searchRadius || fabs(pt.y - p.y) > searchRadius)
+                        {
+                            continue;
+                        }
+
+                        // candidates arrive in cell order, so ties are resolved on the train index explicitly
+                        float d = bBinary ? (float)hammingDistance(query.row(q), train.row(t), train.wordsPerRow)
+                                          : cv::hal::normL2Sqr_(queryDescriptors.ptr<float>(q), trainDescriptors.ptr<float>(t), queryDescriptors.cols);
+                        if (d < dist[k - 1] || (d == dist[k - 1] && t < idx[k - 1]))
+                        {
+                            if (k == 2 && (d < dist[0] || (d == dist[0] && t < idx[0])))
+                            {
+                                dist[1] = dist[0]; idx[1] = idx[0];
+                                dist[0] = d; idx[0] = t;
+                            }
+                            else
+                            {
+                                dist[k - 1] = d; idx[k - 1] = t;
+                            }
+                        }
+                    }
+                }
+            }
+
+            for (int j = 0; j < k; ++j)
+            {
+                if (idx[j] >= 0)
+                {
+                    knnMatches[q].push_back(cv::DMatch(q, idx[j], 0, bBinary ? dist[j] : sqrt(dist[j])));
+                }
+            }
+        }
+    });
+}
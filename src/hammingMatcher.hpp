@@ -0,0 +1,70 @@
+
+#ifndef hammingMatcher_hpp
+#define hammingMatcher_hpp
+
+#include <stdio.h>
+#include <cstdint>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "dataStructures.h"
+
+// binary descriptors (CV_8U, one per row) packed into 64-bit words; every row is zero-padded to a multiple of 32 bytes,
+// so that it can be processed in whole AVX2 registers
+class PackedBinaryDescriptors
+{
+public:
+    PackedBinaryDescriptors() : rows(0), wordsPerRow(0) {}
+    explicit PackedBinaryDescriptors(const cv::Mat &descriptors) { pack(descriptors); }
+
+    void pack(const cv::Mat &descriptors);
+    const uint64_t *row(int i) const { return &data[(size_t)i * wordsPerRow]; }
+
+    int rows;
+    int wordsPerRow; // multiple of 4
+
+private:
+    std::vector<uint64_t, AlignedAllocator<uint64_t>> data;
+};
+
+// brute-force k nearest neighbours (k = 1 or 2) in Hamming distance; knnMatches[i] holds the best matches of query row i
+// sorted by distance with ties going to the lower trainIdx, i.e. the same result as cv::BFMatcher(NORM_HAMMING)::knnMatch.
+// Train rows are processed in cache-sized blocks and query rows are distributed over threads
+void hammingKnnMatch(const PackedBinaryDescriptors &query, const PackedBinaryDescriptors &train, std::vector<std::vector<cv::DMatch>> &knnMatches, int k);
+
+// multi-probe LSH index over binary descriptors: each of nTables hash tables keys the descriptors by keyBits randomly sampled
+// bits, a query visits its own bucket and, for multiProbeLevel 1 (2), all buckets whose key differs in one (up to two) bits.
+// Candidates are ranked by their exact Hamming distance, ties go to the lower trainIdx as in cv::BFMatcher
+class BinaryLshIndex
+{
+public:
+    BinaryLshIndex(int nTables=6, int keyBits=14, int multiProbeLevel=1);
+
+    void build(const cv::Mat &descriptors);
+    // knnMatches[i] holds up to k matches of query row i with the indexed descriptors as train set
+    void knnMatch(const cv::Mat &queryDescriptors, std::vector<std::vector<cv::DMatch>> &knnMatches, int k) const;
+    // share of the query rows whose best LSH match has the same distance as their best brute-force match
+    double recall(const cv::Mat &queryDescriptors) const;
+
+    int nTables, keyBits, multiProbeLevel;
+
+private:
+    unsigned key(const uint64_t *row, int table) const;
+
+    PackedBinaryDescriptors descriptors;
+    std::vector<std::vector<int>> keyBitPositions; // sampled bits of each table
+    std::vector<BucketGrid> buckets;               // descriptor rows of each table by key (2^keyBits buckets)
+    std::vector<unsigned> probeMasks;              // key differences of the probed buckets, 0 (own bucket) first
+};
+
+// guided k nearest neighbours (k = 1 or 2) in Hamming distance for binary (CV_8U) and in L2 distance for floating point (CV_32F)
+// descriptors: query i is only compared with the train keypoints within a
+// square window of +-searchRadius px around predicted[i], which are looked up in a grid over the train keypoints.
+// Ties go to the lower trainIdx; queries without a candidate in their window get no match
+void guidedKnnMatch(const std::vector<cv::Point2f> &predicted, const cv::Mat &queryDescriptors, const std::vector<cv::KeyPoint> &trainKeypoints,
+                    const cv::Mat &trainDescriptors, float searchRadius, std::vector<std::vector<cv::DMatch>> &knnMatches, int k);
+
+// Hamming distance of two packed rows with wordsPerRow words
+int hammingDistance(const uint64_t *a, const uint64_t *b, int wordsPerRow);
+
+#endif /* hammingMatcher_hpp */
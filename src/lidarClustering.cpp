@@ -0,0 +1,114 @@
+
+#include <iostream>
+#include <algorithm>
+
+#include "lidarClustering.hpp"
+
+
+using namespace std;
+
+static inline double coord(const LidarPoint &lpt, int axis)
+{
+    return axis == 0 ? lpt.x : (axis == 1 ? lpt.y : lpt.z);
+}
+
+void KdTree3D::build(const std::vector<LidarPoint> &lidarPoints)
+{
+    points = &lidarPoints;
+    indices.resize(lidarPoints.size());
+    for (size_t i = 0; i < indices.size(); ++i)
+    {
+        indices[i] = (int)i;
+    }
+    build(0, (int)indices.size(), 0);
+}
+
+// the median of [lo, hi) along the split axis becomes the node, smaller points go to [lo, mid), larger ones to [mid+1, hi)
+void KdTree3D::build(int lo, int hi, int depth)
+{
+    if (hi - lo <= 1)
+    {
+        return;
+    }
+    int axis = depth % 3;
+    int mid = lo + (hi - lo) / 2;
+    const vector<LidarPoint> &pts = *points;
+    nth_element(indices.begin() + lo, indices.begin() + mid, indices.begin() + hi,
+                [&pts, axis](int a, int b) { return coord(pts[a], axis) < coord(pts[b], axis); });
+    build(lo, mid, depth + 1);
+    build(mid + 1, hi, depth + 1);
+}
+
+void KdTree3D::radiusSearch(const LidarPoint &query, double radius, std::vector<int> &result) const
+{
+    result.clear();
+    radiusSearch(0, (int)indices.size(), 0, query, radius, result);
+}
+
+void KdTree3D::radiusSearch(int lo, int hi, int depth, const LidarPoint &query, double radius, std::vector<int> &result) const
+{
+    if (lo >= hi)
+    {
+        return;
+    }
+    int axis = depth % 3;
+    int mid = lo + (hi - lo) / 2;
+    const LidarPoint &node = (*points)[indices[mid]];
+
+    double dx = node.x - query.x, dy = node.y - query.y, dz = node.z - query.z;
+    if (dx * dx + dy * dy + dz * dz <= radius * radius)
+    {
+        result.push_back(indices[mid]);
+    }
+
+    // only descend into the half spaces which intersect the search sphere
+    double delta = coord(query, axis) - coord(node, axis);
+    if (delta - radius <= 0)
+    {
+        radiusSearch(lo, mid, depth + 1, query, radius, result);
+    }
+    if (delta + radius >= 0)
+    {
+        radiusSearch(mid + 1, hi, depth + 1, query, radius, result);
+    }
+}
+
+void euclideanClusterLidar(const std::vector<LidarPoint> &lidarPoints, double clusterTolerance, int minSize, std::vector<std::vector<int>> &clusters)
+{
+    clusters.clear();
+    KdTree3D tree;
+    tree.build(lidarPoints);
+
+    // grow each cluster by breadth-first search over the radius neighbours
+    vector<char> bProcessed(lidarPoints.size(), 0);
+    vector<int> neighbours;
+    for (size_t i = 0; i < lidarPoints.size(); ++i)
+    {
+        if (bProcessed[i])
+        {
+            continue;
+        }
+
+        vector<int> cluster(1, (int)i);
+        bProcessed[i] = 1;
+        for (size_t k = 0; k < cluster.size(); ++k)
+        {
+            tree.radiusSearch(lidarPoints[cluster[k]], clusterTolerance, neighbours);
+            for (int j : neighbours)
+            {
+                if (!bProcessed[j])
+                {
+                    bProcessed[j] = 1;
+                    cluster.push_back(j);
+                }
+            }
+        }
+
+        if ((int)cluster.size() >= minSize)
+        {
+            clusters.push_back(cluster);
+        }
+    }
+
+    sort(clusters.begin(), clusters.end(), [](const vector<int> &a, const vector<int> &b) { return a.size() > b.size(); });
+}
@@ -0,0 +1,32 @@
+
+#ifndef lidarClustering_hpp
+#define lidarClustering_hpp
+
+#include <stdio.h>
+#include <vector>
+
+#include "dataStructures.h"
+
+// static 3D kd-tree over a set of Lidar points, nodes are stored implicitly as median splits of an index array
+class KdTree3D
+{
+public:
+    // the tree references lidarPoints, which must outlive it and stay unchanged
+    void build(const std::vector<LidarPoint> &lidarPoints);
+
+    // indices of all points within radius [m] of the query point
+    void radiusSearch(const LidarPoint &query, double radius, std::vector<int> &result) const;
+
+private:
+    void build(int lo, int hi, int depth);
+    void radiusSearch(int lo, int hi, int depth, const LidarPoint &query, double radius, std::vector<int> &result) const;
+
+    const std::vector<LidarPoint> *points = nullptr;
+    std::vector<int> indices;
+};
+
+// groups points into clusters in which each point is within clusterTolerance [m] of another point of the same cluster;
+// clusters with fewer than minSize points are dropped, the remaining ones are sorted by size (largest first)
+void euclideanClusterLidar(const std::vector<LidarPoint> &lidarPoints, double clusterTolerance, int minSize, std::vector<std::vector<int>> &clusters);
+
+#endif /* lidarClustering_hpp */
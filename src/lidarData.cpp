@@ -1,8 +1,18 @@
 
 #include <iostream>
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/core/hal/intrin.hpp>
 #include "lidarData.hpp"
 
 
@@ -11,48 +21,318 @@ using namespace std;
 // remove Lidar points based on min. and max distance in X, Y and Z
 void cropLidarPoints(std::vector<LidarPoint> &lidarPoints, float minX, float maxX, float maxY, float minZ, float maxZ, float minR)
 {
-    std::vector<LidarPoint> newLidarPts; 
+    // compact kept points in place
+    size_t nKept = 0;
     for(auto it=lidarPoints.begin(); it!=lidarPoints.end(); ++it) {
         
        if( (*it).x>=minX && (*it).x<=maxX && (*it).z>=minZ && (*it).z<=maxZ && (*it).z<=0.0 && abs((*it).y)<=maxY && (*it).r>=minR )  // Check if Lidar point is outside of boundaries
        {
-           newLidarPts.push_back(*it);
+           lidarPoints[nKept++] = *it;
        }
     }
 
-    lidarPoints = newLidarPts;
+    lidarPoints.resize(nKept);
 }
 
+// same as above on a structure-of-arrays cloud: a bitmask is computed for a whole SIMD register of points at once
+// and the kept points are compacted in place
+void cropLidarPoints(LidarPointCloud &lidarCloud, float minX, float maxX, float maxY, float minZ, float maxZ, float minR)
+{
+    float *px = lidarCloud.x.data(), *py = lidarCloud.y.data(), *pz = lidarCloud.z.data(), *pr = lidarCloud.r.data();
+    int n = (int)lidarCloud.size();
+    int nKept = 0;
+    int i = 0;
+
+#if CV_SIMD
+    const int nlanes = cv::v_float32::nlanes;
+    cv::v_float32 vMinX = cv::vx_setall_f32(minX), vMaxX = cv::vx_setall_f32(maxX), vMaxY = cv::vx_setall_f32(maxY);
+    cv::v_float32 vMinZ = cv::vx_setall_f32(minZ), vMaxZ = cv::vx_setall_f32(std::min(maxZ, 0.0f)), vMinR = cv::vx_setall_f32(minR);
+    for (; i <= n - nlanes; i += nlanes)
+    {
+        cv::v_float32 vx = cv::vx_load(px + i), vy = cv::vx_load(py + i), vz = cv::vx_load(pz + i), vr = cv::vx_load(pr + i);
+        cv::v_float32 mask = (vx >= vMinX) & (vx <= vMaxX) & (vz >= vMinZ) & (vz <= vMaxZ) & (cv::v_abs(vy) <= vMaxY) & (vr >= vMinR);
+        int bits = cv::v_signmask(mask);
+        if (bits == (1 << nlanes) - 1 && nKept == i)
+        { // all points of this register are kept and nothing has been removed so far
+            nKept += nlanes;
+            continue;
+        }
+        for (; bits != 0; bits &= bits - 1)
+        {
+            int j = i + __builtin_ctz(bits);
+            px[nKept] = px[j]; py[nKept] = py[j]; pz[nKept] = pz[j]; pr[nKept] = pr[j];
+            nKept++;
+        }
+    }
+#endif
+
+    for (; i < n; ++i)
+    {
+        if (px[i] >= minX && px[i] <= maxX && pz[i] >= minZ && pz[i] <= maxZ && pz[i] <= 0.0f && std::abs(py[i]) <= maxY && pr[i] >= minR)
+        {
+            px[nKept] = px[i]; py[nKept] = py[i]; pz[nKept] = pz[i]; pr[nKept] = pr[i];
+            nKept++;
+        }
+    }
+
+    lidarCloud.resize(nKept);
+}
+
+void downsampleLidarPoints(std::vector<LidarPoint> &lidarPoints, float leafSize, std::vector<LidarPixel> *pixels)
+{
+    if (leafSize <= 0.0f || lidarPoints.empty())
+    {
+        return;
+    }
+
+    // find the closest point in x for each occupied voxel
+    unordered_map<uint64_t, int> voxels; // voxel key -> index of the kept point
+    voxels.reserve(lidarPoints.size());
+    for (size_t i = 0; i < lidarPoints.size(); ++i)
+    {
+        const LidarPoint &lpt = lidarPoints[i];
+
+        // 21 bits per axis, offset so that negative voxel indices map to positive keys
+        uint64_t ix = (uint64_t)((int64_t)floor(lpt.x / leafSize) + (1 << 20)) & 0x1FFFFF;
+        uint64_t iy = (uint64_t)((int64_t)floor(lpt.y / leafSize) + (1 << 20)) & 0x1FFFFF;
+        uint64_t iz = (uint64_t)((int64_t)floor(lpt.z / leafSize) + (1 << 20)) & 0x1FFFFF;
+        uint64_t key = (ix << 42) | (iy << 21) | iz;
+
+        auto it = voxels.insert(make_pair(key, (int)i)).first;
+        if (lpt.x < lidarPoints[it->second].x)
+        {
+            it->second = (int)i;
+        }
+    }
+
+    // compact kept points in place, preserving their order
+    vector<char> bKeep(lidarPoints.size(), 0);
+    for (auto it = voxels.begin(); it != voxels.end(); ++it)
+    {
+        bKeep[it->second] = 1;
+    }
+
+    size_t nKept = 0;
+    for (size_t i = 0; i < lidarPoints.size(); ++i)
+    {
+        if (bKeep[i])
+        {
+            lidarPoints[nKept] = lidarPoints[i];
+            if (pixels != nullptr)
+            {
+                (*pixels)[nKept] = (*pixels)[i];
+            }
+            nKept++;
+        }
+    }
+    lidarPoints.resize(nKept);
+    if (pixels != nullptr)
+    {
+        pixels->resize(nKept);
+    }
+}
+
+void toLidarPoints(const LidarPointCloud &lidarCloud, std::vector<LidarPoint> &lidarPoints)
+{
+    lidarPoints.resize(lidarCloud.size());
+    for (size_t i = 0; i < lidarCloud.size(); ++i)
+    {
+        LidarPoint &lpt = lidarPoints[i];
+        lpt.x = lidarCloud.x[i]; lpt.y = lidarCloud.y[i]; lpt.z = lidarCloud.z[i]; lpt.r = lidarCloud.r[i];
+    }
+}
+
+void fromLidarPoints(const std::vector<LidarPoint> &lidarPoints, LidarPointCloud &lidarCloud)
+{
+    lidarCloud.resize(lidarPoints.size());
+    for (size_t i = 0; i < lidarPoints.size(); ++i)
+    {
+        const LidarPoint &lpt = lidarPoints[i];
+        lidarCloud.x[i] = lpt.x; lidarCloud.y[i] = lpt.y; lidarCloud.z[i] = lpt.z; lidarCloud.r[i] = lpt.r;
+    }
+}
+
+
+
+VelodyneScan::VelodyneScan() : mapping(nullptr), mappingSize(0), points(nullptr), numPoints(0)
+{
+}
+
+VelodyneScan::~VelodyneScan()
+{
+    close();
+}
+
+// map a Velodyne .bin file (sequence of x,y,z,r float records) into memory
+bool VelodyneScan::open(const std::string &filename)
+{
+    close();
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        error = "cannot open " + filename + ": " + strerror(errno);
+        return false;
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0)
+    {
+        error = "cannot stat " + filename + ": " + strerror(errno);
+        ::close(fd);
+        return false;
+    }
+
+    size_t fileSize = (size_t)fileStat.st_size;
+    if (fileSize == 0 || fileSize % sizeof(VelodynePoint) != 0)
+    {
+        error = filename + " is empty or truncated (" + std::to_string(fileSize) + " bytes is not a multiple of " + std::to_string(sizeof(VelodynePoint)) + ")";
+        ::close(fd);
+        return false;
+    }
+
+    void *addr = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd); // the mapping stays valid after closing the descriptor
+    if (addr == MAP_FAILED)
+    {
+        error = "cannot map " + filename + ": " + strerror(errno);
+        return false;
+    }
+    madvise(addr, fileSize, MADV_SEQUENTIAL);
 
+    mapping = addr;
+    mappingSize = fileSize;
+    points = (const VelodynePoint *)addr;
+    numPoints = fileSize / sizeof(VelodynePoint);
+    error.clear();
+    return true;
+}
+
+void VelodyneScan::close()
+{
+    if (mapping != nullptr)
+    {
+        munmap(mapping, mappingSize);
+    }
+    mapping = nullptr;
+    mappingSize = 0;
+    points = nullptr;
+    numPoints = 0;
+}
 
 // Load Lidar points from a given location and store them in a vector
-void loadLidarFromFile(vector<LidarPoint> &lidarPoints, string filename)
-{
-    // allocate 4 MB buffer (only ~130*4*4 KB are needed)
-    unsigned long num = 1000000;
-    float *data = (float*)malloc(num*sizeof(float));
-    
-    // pointers
-    float *px = data+0;
-    float *py = data+1;
-    float *pz = data+2;
-    float *pr = data+3;
-    
-    // load point cloud
-    FILE *stream;
-    stream = fopen (filename.c_str(),"rb");
-    num = fread(data,sizeof(float),num,stream)/4;
- 
-    for (int32_t i=0; i<num; i++) {
+bool loadLidarFromFile(vector<LidarPoint> &lidarPoints, string filename)
+{
+    VelodyneScan scan;
+    if (!scan.open(filename))
+    {
+        cerr << "loadLidarFromFile: " << scan.errorMessage() << endl;
+        return false;
+    }
+
+    lidarPoints.reserve(lidarPoints.size() + scan.size());
+    for (const VelodynePoint *it = scan.begin(); it != scan.end(); ++it)
+    {
         LidarPoint lpt;
-        lpt.x = *px; lpt.y = *py; lpt.z = *pz; lpt.r = *pr;
+        lpt.x = it->x; lpt.y = it->y; lpt.z = it->z; lpt.r = it->r;
         lidarPoints.push_back(lpt);
-        px+=4; py+=4; pz+=4; pr+=4;
     }
-    fclose(stream);
+    return true;
+}
+
+// Load Lidar points from a given location into a structure-of-arrays cloud
+bool loadLidarFromFile(LidarPointCloud &lidarCloud, std::string filename)
+{
+    VelodyneScan scan;
+    if (!scan.open(filename))
+    {
+        cerr << "loadLidarFromFile: " << scan.errorMessage() << endl;
+        return false;
+    }
+
+    // de-interleave the x,y,z,r records
+    lidarCloud.resize(scan.size());
+    float *px = lidarCloud.x.data(), *py = lidarCloud.y.data(), *pz = lidarCloud.z.data(), *pr = lidarCloud.r.data();
+    for (size_t i = 0; i < scan.size(); ++i)
+    {
+        px[i] = scan[i].x; py[i] = scan[i].y; pz[i] = scan[i].z; pr[i] = scan[i].r;
+    }
+    return true;
 }
 
 
+LidarProjector::LidarProjector(cv::Mat &P_rect_xx, cv::Mat &R_rect_xx, cv::Mat &RT)
+{
+    cv::Mat composed = P_rect_xx * R_rect_xx * RT; // same evaluation order as the per-point product
+    M = cv::Matx34d((double *)composed.ptr<double>(0));
+}
+
+void LidarProjector::project(const std::vector<LidarPoint> &lidarPoints, std::vector<LidarPixel> &pixels) const
+{
+    pixels.resize(lidarPoints.size());
+    const double *m = M.val;
+    size_t i = 0;
+
+#if CV_SIMD_64F
+    // homogeneous coordinates for a whole register of points; LidarPoint is four packed doubles (x,y,z,r)
+    const int nlanes = cv::v_float64::nlanes;
+    cv::v_float64 m0 = cv::vx_setall_f64(m[0]), m1 = cv::vx_setall_f64(m[1]), m2 = cv::vx_setall_f64(m[2]), m3 = cv::vx_setall_f64(m[3]);
+    cv::v_float64 m4 = cv::vx_setall_f64(m[4]), m5 = cv::vx_setall_f64(m[5]), m6 = cv::vx_setall_f64(m[6]), m7 = cv::vx_setall_f64(m[7]);
+    cv::v_float64 m8 = cv::vx_setall_f64(m[8]), m9 = cv::vx_setall_f64(m[9]), m10 = cv::vx_setall_f64(m[10]), m11 = cv::vx_setall_f64(m[11]);
+    cv::v_float64 zero = cv::vx_setzero_f64();
+    double bufU[cv::v_float64::nlanes], bufV[cv::v_float64::nlanes], bufW[cv::v_float64::nlanes];
+    for (; i + nlanes <= lidarPoints.size(); i += nlanes)
+    {
+        cv::v_float64 x, y, z, r;
+        cv::v_load_deinterleave(&lidarPoints[i].x, x, y, z, r);
+        cv::v_float64 u = m0 * x + m1 * y + m2 * z + m3;
+        cv::v_float64 v = m4 * x + m5 * y + m6 * z + m7;
+        cv::v_float64 w = m8 * x + m9 * y + m10 * z + m11;
+        cv::v_store(bufU, u / w);
+        cv::v_store(bufV, v / w);
+        cv::v_store(bufW, w);
+        for (int k = 0; k < nlanes; ++k)
+        {
+            LidarPixel &pixel = pixels[i + k];
+            pixel.bInFront = bufW[k] > 0.0;
+            pixel.pt = pixel.bInFront ? cv::Point(bufU[k], bufV[k]) : cv::Point(0, 0);
+        }
+    }
+#endif
+
+    for (; i < lidarPoints.size(); ++i)
+    {
+        pixels[i] = project(lidarPoints[i].x, lidarPoints[i].y, lidarPoints[i].z);
+    }
+}
+
+bool loadCropProjectLidar(std::string filename, float minX, float maxX, float maxY, float minZ, float maxZ, float minR,
+                          const LidarProjector &projector, std::vector<LidarPoint> &lidarPoints, std::vector<LidarPixel> &pixels)
+{
+    lidarPoints.clear();
+    pixels.clear();
+
+    VelodyneScan scan;
+    if (!scan.open(filename))
+    {
+        cerr << "loadCropProjectLidar: " << scan.errorMessage() << endl;
+        return false;
+    }
+
+    for (const VelodynePoint *it = scan.begin(); it != scan.end(); ++it)
+    {
+        // same bounds as cropLidarPoints
+        if (it->x >= minX && it->x <= maxX && it->z >= minZ && it->z <= maxZ && it->z <= 0.0f && std::abs(it->y) <= maxY && it->r >= minR)
+        {
+            LidarPoint lpt;
+            lpt.x = it->x; lpt.y = it->y; lpt.z = it->z; lpt.r = it->r;
+            lidarPoints.push_back(lpt);
+            pixels.push_back(projector.project(lpt.x, lpt.y, lpt.z));
+        }
+    }
+    return true;
+}
+
 void showLidarTopview(std::vector<LidarPoint> &lidarPoints, cv::Size worldSize, cv::Size imageSize, bool bWait)
 {
     // create topview image
@@ -90,6 +370,12 @@ void showLidarTopview(std::vector<LidarPoint> &lidarPoints, cv::Size worldSize,
 }
 
 void showLidarImgOverlay(cv::Mat &img, std::vector<LidarPoint> &lidarPoints, cv::Mat &P_rect_xx, cv::Mat &R_rect_xx, cv::Mat &RT, cv::Mat *extVisImg)
+{
+    LidarProjector projector(P_rect_xx, R_rect_xx, RT);
+    showLidarImgOverlay(img, lidarPoints, projector, extVisImg);
+}
+
+void showLidarImgOverlay(cv::Mat &img, std::vector<LidarPoint> &lidarPoints, const LidarProjector &projector, cv::Mat *extVisImg)
 {
     // init image for visualization
     cv::Mat visImg; 
@@ -110,24 +396,19 @@ void showLidarImgOverlay(cv::Mat &img, std::vector<LidarPoint> &lidarPoints, cv:
         maxVal = maxVal<it->x ? it->x : maxVal;
     }
 
-    cv::Mat X(4,1,cv::DataType<double>::type);
-    cv::Mat Y(3,1,cv::DataType<double>::type);
-    for(auto it=lidarPoints.begin(); it!=lidarPoints.end(); ++it) {
-
-            X.at<double>(0, 0) = it->x;
-            X.at<double>(1, 0) = it->y;
-            X.at<double>(2, 0) = it->z;
-            X.at<double>(3, 0) = 1;
+    vector<LidarPixel> pixels;
+    projector.project(lidarPoints, pixels);
+    for(size_t i = 0; i < lidarPoints.size(); ++i) {
 
-            Y = P_rect_xx * R_rect_xx * RT * X;
-            cv::Point pt;
-            pt.x = Y.at<double>(0, 0) / Y.at<double>(0, 2);
-            pt.y = Y.at<double>(1, 0) / Y.at<double>(0, 2);
+            if (!pixels[i].bInFront)
+            {
+                continue; // point cannot be seen by the camera
+            }
 
-            float val = it->x;
+            float val = lidarPoints[i].x;
             int red = min(255, (int)(255 * abs((val - maxVal) / maxVal)));
             int green = min(255, (int)(255 * (1 - abs((val - maxVal) / maxVal))));
-            cv::circle(overlay, pt, 5, cv::Scalar(0, green, red), -1);
+            cv::circle(overlay, pixels[i].pt, 5, cv::Scalar(0, green, red), -1);
     }
 
     float opacity = 0.6;
@@ -8,9 +8,95 @@
 
 #include "dataStructures.h"
 
+struct VelodynePoint { // raw record of a Velodyne .bin file
+    float x,y,z,r;
+};
+
+// read-only view of a Velodyne scan which is memory-mapped from file, records are accessed in place without copies
+class VelodyneScan
+{
+public:
+    VelodyneScan();
+    ~VelodyneScan();
+    VelodyneScan(const VelodyneScan &) = delete; // not copyable, owns the mapping
+    VelodyneScan &operator=(const VelodyneScan &) = delete;
+
+    bool open(const std::string &filename); // returns false and sets errorMessage() for missing, empty or truncated files
+    void close();
+
+    size_t size() const { return numPoints; }
+    const VelodynePoint *begin() const { return points; }
+    const VelodynePoint *end() const { return points + numPoints; }
+    const VelodynePoint &operator[](size_t i) const { return points[i]; }
+    const std::string &errorMessage() const { return error; }
+
+private:
+    void *mapping;       // start of the mapped file
+    size_t mappingSize;  // size of the mapped file in bytes
+    const VelodynePoint *points;
+    size_t numPoints;
+    std::string error;
+};
+
+typedef std::vector<float, AlignedAllocator<float>> AlignedFloatVector;
+
+struct LidarPointCloud { // Lidar points as structure of arrays in single precision, used for vectorized processing of whole scans
+    AlignedFloatVector x, y, z, r; // x,y,z in [m], r is point reflectivity
+
+    size_t size() const { return x.size(); }
+    void resize(size_t n) { x.resize(n); y.resize(n); z.resize(n); r.resize(n); }
+    void reserve(size_t n) { x.reserve(n); y.reserve(n); z.reserve(n); r.reserve(n); }
+    void clear() { x.clear(); y.clear(); z.clear(); r.clear(); }
+};
+
 void cropLidarPoints(std::vector<LidarPoint> &lidarPoints, float minX, float maxX, float maxY, float minZ, float maxZ, float minR);
-void loadLidarFromFile(std::vector<LidarPoint> &lidarPoints, std::string filename);
+void cropLidarPoints(LidarPointCloud &lidarCloud, float minX, float maxX, float maxY, float minZ, float maxZ, float minR);
+bool loadLidarFromFile(std::vector<LidarPoint> &lidarPoints, std::string filename);
+bool loadLidarFromFile(LidarPointCloud &lidarCloud, std::string filename);
+
+struct LidarPixel { // projection of a Lidar point into the camera image
+    cv::Point pt;  // pixel coordinates, only valid if bInFront is set
+    bool bInFront; // false for points on or behind the image plane of the camera
+};
+
+// projection engine: the 3x4 camera matrix P_rect_xx * R_rect_xx * RT is composed once per calibration
+// and whole batches of Lidar points are projected with it into a caller-owned (reusable) pixel buffer
+class LidarProjector
+{
+public:
+    LidarProjector(cv::Mat &P_rect_xx, cv::Mat &R_rect_xx, cv::Mat &RT);
+
+    void project(const std::vector<LidarPoint> &lidarPoints, std::vector<LidarPixel> &pixels) const;
+
+    LidarPixel project(double x, double y, double z) const
+    {
+        const double *m = M.val;
+        double u = m[0] * x + m[1] * y + m[2] * z + m[3];
+        double v = m[4] * x + m[5] * y + m[6] * z + m[7];
+        double w = m[8] * x + m[9] * y + m[10] * z + m[11];
+        LidarPixel pixel;
+        pixel.bInFront = w > 0.0;
+        pixel.pt = pixel.bInFront ? cv::Point(u / w, v / w) : cv::Point(0, 0);
+        return pixel;
+    }
+
+    cv::Matx34d M; // maps homogeneous Lidar coordinates to homogeneous pixel coordinates
+};
+
+// single pass over the memory-mapped scan: crop to the given bounds, project survivors into the image and write only those
+// points together with their pixel coordinates (replaces loadLidarFromFile + cropLidarPoints + projection)
+bool loadCropProjectLidar(std::string filename, float minX, float maxX, float maxY, float minZ, float maxZ, float minR,
+                          const LidarProjector &projector, std::vector<LidarPoint> &lidarPoints, std::vector<LidarPixel> &pixels);
+
+// voxel-grid downsampling with a hashed voxel map: keeps the point with the smallest x in each cubic voxel of size leafSize [m]
+// so that the closest distance to an object is preserved; pixels (if given) is filtered alongside lidarPoints
+void downsampleLidarPoints(std::vector<LidarPoint> &lidarPoints, float leafSize, std::vector<LidarPixel> *pixels=nullptr);
+
+// adapters between the point cloud and the per-point representation used by DataFrame and BoundingBox
+void toLidarPoints(const LidarPointCloud &lidarCloud, std::vector<LidarPoint> &lidarPoints);
+void fromLidarPoints(const std::vector<LidarPoint> &lidarPoints, LidarPointCloud &lidarCloud);
 
 void showLidarTopview(std::vector<LidarPoint> &lidarPoints, cv::Size worldSize, cv::Size imageSize, bool bWait=true);
 void showLidarImgOverlay(cv::Mat &img, std::vector<LidarPoint> &lidarPoints, cv::Mat &P_rect_xx, cv::Mat &R_rect_xx, cv::Mat &RT, cv::Mat *extVisImg=nullptr);
+void showLidarImgOverlay(cv::Mat &img, std::vector<LidarPoint> &lidarPoints, const LidarProjector &projector, cv::Mat *extVisImg=nullptr);
 #endif /* lidarData_hpp */
@@ -0,0 +1,241 @@
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+#include "lidarRangeImage.hpp"
+
+
+using namespace std;
+
+LidarRangeImage::LidarRangeImage(int rows, int cols, float minElevationDeg, float maxElevationDeg)
+    : rows(rows), cols(cols), minElevation(minElevationDeg * CV_PI / 180.0), maxElevation(maxElevationDeg * CV_PI / 180.0), points(nullptr),
+      rowOffset(0), colOffset(0), gridRows(0), gridCols(0)
+{
+}
+
+// elevation ring of a point, rows outside the vertical field of view are clamped to the first / last ring
+int LidarRangeImage::row(double x, double y, double z) const
+{
+    double elevation = atan2(z, sqrt(x * x + y * y));
+    int r = (int)floor((elevation - minElevation) / (maxElevation - minElevation) * rows);
+    return min(max(r, 0), rows - 1);
+}
+
+// azimuth column of a point, azimuth 0 (straight ahead) is in the middle of the image
+int LidarRangeImage::col(double x, double y) const
+{
+    double azimuth = atan2(y, x);
+    int c = (int)floor((azimuth + CV_PI) / (2 * CV_PI) * cols);
+    return min(max(c, 0), cols - 1);
+}
+
+// grid cell of an image row and column, -1 outside the window covered by the points
+int LidarRangeImage::cell(int r, int c) const
+{
+    r -= rowOffset;
+    c -= colOffset;
+    return r >= 0 && r < gridRows && c >= 0 && c < gridCols ? r * gridCols + c : -1;
+}
+
+void LidarRangeImage::build(const std::vector<LidarPoint> &lidarPoints)
+{
+    points = &lidarPoints;
+
+    // image coordinates of all points and the window they cover, a box only needs a small part of the image
+    pointRow.resize(lidarPoints.size());
+    pointCol.resize(lidarPoints.size());
+    int rowLo = rows, rowHi = -1, colLo = cols, colHi = -1;
+    for (size_t i = 0; i < lidarPoints.size(); ++i)
+    {
+        const LidarPoint &lpt = lidarPoints[i];
+        pointRow[i] = row(lpt.x, lpt.y, lpt.z);
+        pointCol[i] = col(lpt.x, lpt.y);
+        rowLo = min(rowLo, pointRow[i]);
+        rowHi = max(rowHi, pointRow[i]);
+        colLo = min(colLo, pointCol[i]);
+        colHi = max(colHi, pointCol[i]);
+    }
+    rowOffset = rowLo;
+    colOffset = colLo;
+    gridRows = max(rowHi - rowLo + 1, 0);
+    gridCols = max(colHi - colLo + 1, 0);
+
+    // counting sort of point indices by cell
+    pointCell.resize(lidarPoints.size());
+    for (size_t i = 0; i < lidarPoints.size(); ++i)
+    {
+        pointCell[i] = cell(pointRow[i], pointCol[i]);
+    }
+    grid.build(pointCell, gridRows * gridCols);
+}
+
+void LidarRangeImage::crop(float minX, float maxX, float maxY, float minZ, float maxZ, float minR, std::vector<LidarPoint> &croppedPoints,
+                           std::vector<int> *scanIndices) const
+{
+    croppedPoints.clear();
+    if (scanIndices != nullptr)
+    {
+        scanIndices->clear();
+    }
+    if (points == nullptr)
+    {
+        return;
+    }
+
+    // azimuth window: |y| <= maxY and x >= minX > 0 limits the azimuth to +-atan(maxY / minX)
+    int colLo = 0, colHi = cols - 1;
+    if (minX > 0)
+    {
+        colLo = max(col(minX, -maxY) - 1, 0); // one column margin against rounding at the window borders
+        colHi = min(col(minX, maxY) + 1, cols - 1);
+    }
+
+    // elevation window: extremes of atan2(z, range) are found at the corners of the z and range intervals
+    double zLo = minZ, zHi = min(maxZ, 0.0f);
+    double rangeLo = max((double)minX, 0.0), rangeHi = sqrt((double)maxX * maxX + (double)maxY * maxY);
+    int rowLo = rows - 1, rowHi = 0;
+    double zs[] = {zLo, zHi}, ranges[] = {rangeLo, rangeHi};
+    for (double z : zs)
+    {
+        for (double range : ranges)
+        {
+            int r = row(range, 0.0, z);
+            rowLo = min(rowLo, r);
+            rowHi = max(rowHi, r);
+        }
+    }
+    rowLo = max(rowLo - 1, 0);
+    rowHi = min(rowHi + 1, rows - 1);
+
+    // exact test on the points inside the window only
+    vector<int> kept;
+    for (int r = rowLo; r <= rowHi; ++r)
+    {
+        for (int c = colLo; c <= colHi; ++c)
+        {
+            int cellIdx = cell(r, c);
+            if (cellIdx < 0)
+            {
+                continue;
+            }
+            for (int j = grid.start[cellIdx]; j < grid.start[cellIdx + 1]; ++j)
+            {
+                const LidarPoint &lpt = (*points)[grid.items[j]];
+                if (lpt.x >= minX && lpt.x <= maxX && lpt.z >= minZ && lpt.z <= maxZ && lpt.z <= 0.0 && abs(lpt.y) <= maxY && lpt.r >= minR)
+                {
+                    kept.push_back(grid.items[j]);
+                }
+            }
+        }
+    }
+
+    // restore scan order
+    sort(kept.begin(), kept.end());
+    croppedPoints.reserve(kept.size());
+    for (int idx : kept)
+    {
+        croppedPoints.push_back((*points)[idx]);
+    }
+    if (scanIndices != nullptr)
+    {
+        scanIndices->swap(kept);
+    }
+}
+
+int LidarRangeImage::countNeighbours(size_t idx, float radius, const std::vector<int> *labels) const
+{
+    const LidarPoint &p = (*points)[idx];
+    int r0 = pointRow[idx], c0 = pointCol[idx];
+
+    // a neighbour within radius is seen under an angle of at most asin(radius / range) from the sensor
+    double range = sqrt(p.x * p.x + p.y * p.y + p.z * p.z);
+    double maxAngle = range > radius ? asin(radius / range) : CV_PI;
+    int colWindow = min((int)ceil(maxAngle / (2 * CV_PI / cols)) + 1, cols / 2);
+    int rowWindow = min((int)ceil(maxAngle / ((maxElevation - minElevation) / rows)) + 1, rows);
+
+    int nNeighbours = 0;
+    double radiusSq = (double)radius * radius;
+    for (int r = max(r0 - rowWindow, 0); r <= min(r0 + rowWindow, rows - 1); ++r)
+    {
+        for (int dc = -colWindow; dc <= colWindow; ++dc)
+        {
+            int cellIdx = cell(r, (c0 + dc + cols) % cols); // azimuth wraps around
+            if (cellIdx < 0)
+            {
+                continue;
+            }
+            for (int j = grid.start[cellIdx]; j < grid.start[cellIdx + 1]; ++j)
+            {
+                if (labels != nullptr && (*labels)[grid.items[j]] != (*labels)[idx])
+                {
+                    continue;
+                }
+                const LidarPoint &q = (*points)[grid.items[j]];
+                double dx = q.x - p.x, dy = q.y - p.y, dz = q.z - p.z;
+                if ((size_t)grid.items[j] != idx && dx * dx + dy * dy + dz * dz <= radiusSq)
+                {
+                    nNeighbours++;
+                }
+            }
+        }
+    }
+    return nNeighbours;
+}
+
+void removeLidarOutliers(std::vector<BoundingBox> &boundingBoxes, float radius, int minNeighbours)
+{
+    LidarRangeImage rangeImage; // the grid only spans the window covered by the points of each box
+    for (auto it = boundingBoxes.begin(); it != boundingBoxes.end(); ++it)
+    {
+        rangeImage.build(it->lidarPoints);
+
+        vector<char> bKeep(it->lidarPoints.size());
+        for (size_t i = 0; i < it->lidarPoints.size(); ++i)
+        {
+            bKeep[i] = rangeImage.countNeighbours(i, radius) >= minNeighbours;
+        }
+
+        size_t nKept = 0;
+        for (size_t i = 0; i < it->lidarPoints.size(); ++i)
+        {
+            if (bKeep[i])
+            {
+                it->lidarPoints[nKept++] = it->lidarPoints[i];
+            }
+        }
+        it->lidarPoints.resize(nKept);
+    }
+}
+
+void removeLidarOutliers(std::vector<BoundingBox> &boundingBoxes, const LidarRangeImage &scanImage, const std::vector<int> &scanIndices,
+                         const std::vector<int> &pointBoxes, float radius, int minNeighbours)
+{
+    // label the scan points with their box, neighbours are only counted within the same box
+    vector<int> labels(scanImage.size(), -1);
+    for (size_t i = 0; i < scanIndices.size(); ++i)
+    {
+        labels[scanIndices[i]] = pointBoxes[i];
+    }
+
+    // the points of each box are in the order of the cropped points, which is scan order
+    vector<size_t> nKept(boundingBoxes.size(), 0), nSeen(boundingBoxes.size(), 0);
+    for (size_t i = 0; i < scanIndices.size(); ++i)
+    {
+        int b = pointBoxes[i];
+        if (b < 0)
+        {
+            continue;
+        }
+        vector<LidarPoint> &boxPoints = boundingBoxes[b].lidarPoints;
+        if (scanImage.countNeighbours(scanIndices[i], radius, &labels) >= minNeighbours)
+        {
+            boxPoints[nKept[b]++] = boxPoints[nSeen[b]];
+        }
+        nSeen[b]++;
+    }
+    for (size_t b = 0; b < boundingBoxes.size(); ++b)
+    {
+        boundingBoxes[b].lidarPoints.resize(nKept[b]);
+    }
+}
@@ -0,0 +1,54 @@
+
+#ifndef lidarRangeImage_hpp
+#define lidarRangeImage_hpp
+
+#include <stdio.h>
+#include <vector>
+
+#include "dataStructures.h"
+
+// spherical range image of a Velodyne scan: points are binned by elevation (rows, one per laser ring of the HDL-64)
+// and azimuth (columns) into a dense grid, each cell references the indices of the points falling into it. The grid is
+// allocated for the row/column window covered by the points only, so a box of a few hundred points gets a small grid
+class LidarRangeImage
+{
+public:
+    LidarRangeImage(int rows=64, int cols=2048, float minElevationDeg=-24.9f, float maxElevationDeg=2.0f);
+
+    // bins all points; the range image references lidarPoints, which must outlive it and stay unchanged
+    void build(const std::vector<LidarPoint> &lidarPoints);
+
+    // same result (and order) as cropLidarPoints, only the cells inside the azimuth/elevation window of the bounds are visited;
+    // scanIndices (if given) receives the index of each cropped point in the scan, so that the image can be queried for them later
+    void crop(float minX, float maxX, float maxY, float minZ, float maxZ, float minR, std::vector<LidarPoint> &croppedPoints,
+              std::vector<int> *scanIndices=nullptr) const;
+
+    // no. of points within radius [m] of point idx, found by looking at the neighbouring cells only; with labels (one per point),
+    // only points with the same label as idx are counted
+    int countNeighbours(size_t idx, float radius, const std::vector<int> *labels=nullptr) const;
+
+    size_t size() const { return points != nullptr ? points->size() : 0; }
+
+    int row(double x, double y, double z) const;
+    int col(double x, double y) const;
+    int cell(int r, int c) const;
+
+private:
+    int rows, cols;
+    double minElevation, maxElevation; // in [rad]
+    const std::vector<LidarPoint> *points;
+    int rowOffset, colOffset;    // first image row and column of the grid
+    int gridRows, gridCols;      // size of the grid window
+    BucketGrid grid;             // point indices by cell, row-major
+    std::vector<int> pointCell;  // cell of each point
+    std::vector<int> pointRow, pointCol; // image row and column of each point
+};
+
+// drops points with fewer than minNeighbours other points within radius [m] from the Lidar points of each box
+void removeLidarOutliers(std::vector<BoundingBox> &boundingBoxes, float radius, int minNeighbours);
+// same filter served by the range image of the whole scan, so that its build cost is shared with the crop: scanIndices are the
+// scan indices of the cropped points (from crop) and pointBoxes the box each cropped point was assigned to (from clusterLidarWithROI)
+void removeLidarOutliers(std::vector<BoundingBox> &boundingBoxes, const LidarRangeImage &scanImage, const std::vector<int> &scanIndices,
+                         const std::vector<int> &pointBoxes, float radius, int minNeighbours);
+
+#endif /* lidarRangeImage_hpp */
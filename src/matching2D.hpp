@@ -13,19 +13,84 @@
 #include <opencv2/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/video/tracking.hpp>
 #include <opencv2/features2d.hpp>
 #include <opencv2/xfeatures2d.hpp>
 #include <opencv2/xfeatures2d/nonfree.hpp>
 
 #include "dataStructures.h"
+#include "hammingMatcher.hpp"
+
+// detectors and descriptors supported by this project
+enum DetectorType { DET_SHITOMASI, DET_HARRIS, DET_FAST, DET_BRISK, DET_ORB, DET_AKAZE, DET_SIFT };
+enum DescriptorType { DESC_BRISK, DESC_ORB, DESC_FREAK, DESC_AKAZE, DESC_SIFT };
+
+// conversion from and to the names used on the command line and in the logs; unknown names map to SIFT
+DetectorType getDetectorType(std::string name);
+DescriptorType getDescriptorType(std::string name);
+const char *getDetectorName(DetectorType detectorType);
+const char *getDescriptorName(DescriptorType descriptorType);
+
+// new detector / extractor instance with the parameters used throughout this project
+cv::Ptr<cv::FeatureDetector> createDetector(DetectorType detectorType);
+cv::Ptr<cv::DescriptorExtractor> createDescriptorExtractor(DescriptorType descriptorType);
+
+// detector and descriptor extractor constructed once at startup and reused for every frame
+class FeatureRegistry
+{
+public:
+    FeatureRegistry(DetectorType detectorType, DescriptorType descriptorType);
+
+    // an optional 8-bit mask restricts detection to its non-zero pixels and drops the keypoints outside of it before description
+    void detect(std::vector<cv::KeyPoint> &keypoints, cv::Mat &img, bool bVis=false, const cv::Mat &mask=cv::Mat());
+    void describe(std::vector<cv::KeyPoint> &keypoints, cv::Mat &img, cv::Mat &descriptors, const cv::Mat &mask=cv::Mat());
+
+    // splits detection into tileCols x tileRows tiles which overlap by tileOverlap px and are processed in parallel, each with its
+    // own detector instance; a keypoint is kept by the tile whose core (the tile without overlap) contains it, and every tile keeps
+    // at most maxKeypointsPerTile of its strongest keypoints (0 = no limit). Harris is always detected on the whole image
+    void setTiling(int tileCols, int tileRows, int tileOverlap=32, int maxKeypointsPerTile=0);
+
+    DetectorType detectorType;
+    DescriptorType descriptorType;
+
+private:
+    cv::Ptr<cv::FeatureDetector> detector;         // empty for the classic detectors (Shi-Tomasi, Harris)
+    cv::Ptr<cv::DescriptorExtractor> extractor;
+
+    void detectTiled(std::vector<cv::KeyPoint> &keypoints, cv::Mat &img, const cv::Mat &mask);
+
+    int tileCols, tileRows, tileOverlap, maxKeypointsPerTile;
+    std::vector<cv::Ptr<cv::FeatureDetector>> tileDetectors;
+};
 
 void visualizeResults(cv::Mat img, std::vector<cv::KeyPoint> &keypoints, std::string name);
 
-void detKeypointsHarris(std::vector<cv::KeyPoint> &keypoints, cv::Mat &img, bool bVis=false);
-void detKeypointsShiTomasi(std::vector<cv::KeyPoint> &keypoints, cv::Mat &img, bool bVis=false);
-void detKeypointsModern(std::vector<cv::KeyPoint> &keypoints, cv::Mat &img, std::string detectorType, bool bVis=false);
-void descKeypoints(std::vector<cv::KeyPoint> &keypoints, cv::Mat &img, cv::Mat &descriptors, std::string descriptorType);
+void detKeypointsHarris(std::vector<cv::KeyPoint> &keypoints, cv::Mat &img, bool bVis=false, const cv::Mat &mask=cv::Mat());
+// non-maximum suppression of a Harris response (CV_32F, normalized to [0, 255]): keeps the pixels above minResponse which are the
+// strongest within keypointSize; each cell of a grid is searched for its best pixel, which is then tested against its neighbourhood.
+// The result is the set of strict local maxima, independent of scan order; nmsHarrisOverlap replaces keypoints in raster order
+// and can keep a pixel whose stronger neighbour was itself replaced, so both sets agree closely but are not identical
+void nmsHarrisGrid(const cv::Mat &response, int minResponse, float keypointSize, std::vector<cv::KeyPoint> &keypoints);
+// previous implementation comparing every candidate with all accepted keypoints via cv::KeyPoint::overlap (kept for benchmarking)
+void nmsHarrisOverlap(const cv::Mat &response, int minResponse, float keypointSize, std::vector<cv::KeyPoint> &keypoints);
+void detKeypointsShiTomasi(std::vector<cv::KeyPoint> &keypoints, cv::Mat &img, bool bVis=false, const cv::Mat &mask=cv::Mat());
+void detKeypointsModern(std::vector<cv::KeyPoint> &keypoints, cv::Mat &img, std::string detectorType, bool bVis=false, const cv::Mat &mask=cv::Mat());
+void descKeypoints(std::vector<cv::KeyPoint> &keypoints, cv::Mat &img, cv::Mat &descriptors, std::string descriptorType, const cv::Mat &mask=cv::Mat());
+// carries the keypoints of the previous frame into the current frame with pyramidal Lucas-Kanade flow; tracks which fail or
+// do not return to within maxFbError px of their origin when tracked backwards are dropped. kptsCurr receives the tracked
+// keypoints and matches links them to their origin (queryIdx = previous, trainIdx = current) as matchDescriptors does
+void trackKeypointsKLT(const std::vector<cv::KeyPoint> &kptsPrev, const cv::Mat &imgPrev, const cv::Mat &imgCurr,
+                       std::vector<cv::KeyPoint> &kptsCurr, std::vector<cv::DMatch> &matches, float maxFbError=1.0);
+// appends the detected keypoints which are at least minDistance px away from all keypoints, returns the no. of added keypoints
+int addUntrackedKeypoints(std::vector<cv::KeyPoint> &keypoints, const std::vector<cv::KeyPoint> &detected, cv::Size imgSize, float minDistance);
+// 8-bit mask which is non-zero inside all bounding boxes, each expanded by margin times its size on every side;
+// returns the fraction of the image area covered by the mask
+double makeBoundingBoxMask(const std::vector<BoundingBox> &boundingBoxes, cv::Size imgSize, float margin, cv::Mat &mask);
+// matcherType MAT_LSH searches descRef in sourceIndex (an index over descSource, built on the fly if null);
+// MAT_GUIDED only compares each source keypoint with the reference keypoints within +-searchRadius px of its predicted position
+// in the reference frame (predictedSource, its own position if null)
 void matchDescriptors(std::vector<cv::KeyPoint> &kPtsSource, std::vector<cv::KeyPoint> &kPtsRef, cv::Mat &descSource, cv::Mat &descRef,
-                      std::vector<cv::DMatch> &matches, std::string descriptorType, std::string matcherType, std::string selectorType);
+                      std::vector<cv::DMatch> &matches, std::string descriptorType, std::string matcherType, std::string selectorType,
+                      const BinaryLshIndex *sourceIndex=nullptr, const std::vector<cv::Point2f> *predictedSource=nullptr, float searchRadius=60);
 
 #endif /* matching2D_hpp */
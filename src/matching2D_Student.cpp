@@ -5,13 +5,30 @@
 
 using namespace std;
 
+// swaps query and train index of all matches
+static void flipMatches(vector<vector<cv::DMatch>> &knnMatches)
+{
+    for (auto it = knnMatches.begin(); it != knnMatches.end(); ++it)
+    {
+        for (auto m = it->begin(); m != it->end(); ++m)
+        {
+            swap(m->queryIdx, m->trainIdx);
+        }
+    }
+}
+
 // Find best matches for keypoints in two camera images based on several matching methods
 void matchDescriptors(std::vector<cv::KeyPoint> &kPtsSource, std::vector<cv::KeyPoint> &kPtsRef, cv::Mat &descSource, cv::Mat &descRef,
-                      std::vector<cv::DMatch> &matches, std::string descriptorType, std::string matcherType, std::string selectorType)
+                      std::vector<cv::DMatch> &matches, std::string descriptorType, std::string matcherType, std::string selectorType,
+                      const BinaryLshIndex *sourceIndex, const std::vector<cv::Point2f> *predictedSource, float searchRadius)
 {
     // configure matcher
     bool crossCheck = false;
     cv::Ptr<cv::DescriptorMatcher> matcher;
+    bool bHammingSimd = matcherType.compare("MAT_HAMMING_SIMD") == 0; // same results as MAT_BF from packed descriptors and vectorized popcount
+    bool bLsh = matcherType.compare("MAT_LSH") == 0;                  // approximate search of descRef in an LSH index of descSource
+    bool bGuided = matcherType.compare("MAT_GUIDED") == 0;            // search windows around the predicted positions of the source keypoints
+    cv::Mat querySet = descSource, trainSet = descRef;
 
     if (matcherType.compare("MAT_BF") == 0)
     {
@@ -22,18 +39,64 @@ void matchDescriptors(std::vector<cv::KeyPoint> &kPtsSource, std::vector<cv::Key
     {
         // ...
         if (descSource.type() != CV_32F)
-        {
-            descSource.convertTo(descSource, CV_32F);
-            descRef.convertTo(descRef, CV_32F);
+        { // converted copies, the descriptors of the frames stay binary
+            descSource.convertTo(querySet, CV_32F);
+            descRef.convertTo(trainSet, CV_32F);
         }
         matcher = cv::FlannBasedMatcher::create();
     }
 
+    // without a prediction the source keypoints are expected at their old position
+    vector<cv::Point2f> unmovedSource;
+    if (bGuided && predictedSource == nullptr)
+    {
+        for (auto it = kPtsSource.begin(); it != kPtsSource.end(); ++it)
+        {
+            unmovedSource.push_back(it->pt);
+        }
+        predictedSource = &unmovedSource;
+    }
+
+    // the LSH index of the previous frame is reused if given, the matches are flipped so that queryIdx refers to descSource
+    BinaryLshIndex localIndex;
+    if (bLsh && sourceIndex == nullptr)
+    {
+        localIndex.build(descSource);
+        sourceIndex = &localIndex;
+    }
+
     // perform matching task
     if (selectorType.compare("SEL_NN") == 0)
     { // nearest neighbor (best match)
 
-        matcher->match(descSource, descRef, matches); // Finds the best match for each descriptor in desc1
+        if (bHammingSimd || bLsh || bGuided)
+        {
+            vector<vector<cv::DMatch>> knnMatches;
+            if (bLsh)
+            {
+                sourceIndex->knnMatch(descRef, knnMatches, 1);
+                flipMatches(knnMatches);
+            }
+            else if (bGuided)
+            {
+                guidedKnnMatch(*predictedSource, descSource, kPtsRef, descRef, searchRadius, knnMatches, 1);
+            }
+            else
+            {
+                hammingKnnMatch(PackedBinaryDescriptors(descSource), PackedBinaryDescriptors(descRef), knnMatches, 1);
+            }
+            for (auto it = knnMatches.begin(); it != knnMatches.end(); ++it)
+            {
+                if (it->size() > 0)
+                {
+                    matches.push_back((*it)[0]);
+                }
+            }
+        }
+        else
+        {
+            matcher->match(querySet, trainSet, matches); // Finds the best match for each descriptor in desc1
+        }
     }
     else if (selectorType.compare("SEL_KNN") == 0)
     { // k nearest neighbors (k=2)
@@ -41,11 +104,31 @@ void matchDescriptors(std::vector<cv::KeyPoint> &kPtsSource, std::vector<cv::Key
         vector<vector<cv::DMatch>> knnMatches;
         int k = 2;
         double compareRatio = 0.8;
-        matcher->knnMatch(descSource, descRef, knnMatches, k);
+        if (bHammingSimd)
+        {
+            hammingKnnMatch(PackedBinaryDescriptors(descSource), PackedBinaryDescriptors(descRef), knnMatches, k);
+        }
+        else if (bLsh)
+        {
+            sourceIndex->knnMatch(descRef, knnMatches, k);
+            flipMatches(knnMatches);
+        }
+        else if (bGuided)
+        {
+            guidedKnnMatch(*predictedSource, descSource, kPtsRef, descRef, searchRadius, knnMatches, k);
+        }
+        else
+        {
+            matcher->knnMatch(querySet, trainSet, knnMatches, k);
+        }
 
         double ratio;
         for (vector<cv::DMatch> matchArr : knnMatches)
         {
+            if (matchArr.size() < 2)
+            { // approximate and guided matchers may find fewer than k candidates
+                continue;
+            }
             ratio = matchArr[0].distance / matchArr[1].distance;
             if (ratio >= compareRatio)
             {
@@ -56,12 +139,12 @@ void matchDescriptors(std::vector<cv::KeyPoint> &kPtsSource, std::vector<cv::Key
     }
 }
 
-// Use one of several types of state-of-art descriptors to uniquely identify keypoints
-void descKeypoints(vector<cv::KeyPoint> &keypoints, cv::Mat &img, cv::Mat &descriptors, string descriptorType)
+// Create one of several types of state-of-art descriptors to uniquely identify keypoints
+cv::Ptr<cv::DescriptorExtractor> createDescriptorExtractor(DescriptorType descriptorType)
 {
     // select appropriate descriptor
     cv::Ptr<cv::DescriptorExtractor> extractor;
-    if (descriptorType.compare("BRISK") == 0)
+    if (descriptorType == DESC_BRISK)
     {
 
         int threshold = 30;        // FAST/AGAST detection threshold score.
@@ -70,7 +153,7 @@ void descKeypoints(vector<cv::KeyPoint> &keypoints, cv::Mat &img, cv::Mat &descr
 
         extractor = cv::BRISK::create(threshold, octaves, patternScale);
     }
-    else if (descriptorType.compare("ORB") == 0)
+    else if (descriptorType == DESC_ORB)
     {
         int nfeat = 500;
         float scaleFactor = 1.2f;
@@ -83,7 +166,7 @@ void descKeypoints(vector<cv::KeyPoint> &keypoints, cv::Mat &img, cv::Mat &descr
         int fastThreshold = 20;
         extractor = cv::ORB::create(nfeat, scaleFactor, nLevels, edgeThreshold, firstLevel, wta_k, cv::ORB::HARRIS_SCORE, patchSize, fastThreshold);
     }
-    else if (descriptorType.compare("FREAK") == 0)
+    else if (descriptorType == DESC_FREAK)
     {
         bool orientationNormalized = true;
         bool scaleNormalized = true;
@@ -91,7 +174,7 @@ void descKeypoints(vector<cv::KeyPoint> &keypoints, cv::Mat &img, cv::Mat &descr
         int nOctaves = 4;
         extractor = cv::xfeatures2d::FREAK::create(orientationNormalized, scaleNormalized, patternScale, nOctaves);
     }
-    else if (descriptorType.compare("AKAZE") == 0)
+    else if (descriptorType == DESC_AKAZE)
     {
         int descriptorSize = 0;
         int descriptorChannels = 3;
@@ -111,9 +194,20 @@ void descKeypoints(vector<cv::KeyPoint> &keypoints, cv::Mat &img, cv::Mat &descr
         double sigma = 1.6;
         extractor = cv::xfeatures2d::SIFT::create(nfeatures, nOctaveLayers, contrastThreshold, edgeThreshold, sigma);
     }
-    
+    return extractor;
+}
+
+// Use one of several types of state-of-art descriptors to uniquely identify keypoints
+void descKeypoints(vector<cv::KeyPoint> &keypoints, cv::Mat &img, cv::Mat &descriptors, string descriptorType, const cv::Mat &mask)
+{
+    cv::Ptr<cv::DescriptorExtractor> extractor = createDescriptorExtractor(getDescriptorType(descriptorType));
+
     // perform feature description
     double t = (double)cv::getTickCount();
+    if (!mask.empty())
+    {
+        cv::KeyPointsFilter::runByPixelsMask(keypoints, mask);
+    }
     extractor->compute(img, keypoints, descriptors);
     t = ((double)cv::getTickCount() - t) / cv::getTickFrequency();
     cout << descriptorType << " descriptor extraction in " << 1000 * t / 1.0 << " ms" << endl;
@@ -130,8 +224,8 @@ void visualizeResults(cv::Mat img, vector<cv::KeyPoint> &keypoints, string name)
     cv::waitKey(0);
 }
 
-// Detect keypoints in image using the traditional Shi-Thomasi detector
-void detKeypointsShiTomasi(vector<cv::KeyPoint> &keypoints, cv::Mat &img, bool bVis)
+// Shi-Tomasi corners of img appended to keypoints, shared by the whole-image and the tiled detection
+static void detectShiTomasiCorners(vector<cv::KeyPoint> &keypoints, const cv::Mat &img, const cv::Mat &mask)
 {
     // compute detector parameters based on image size
     int blockSize = 4;       //  size of an average block for computing a derivative covariation matrix over each pixel neighborhood
@@ -143,9 +237,8 @@ void detKeypointsShiTomasi(vector<cv::KeyPoint> &keypoints, cv::Mat &img, bool b
     double k = 0.04;
 
     // Apply corner detection
-    double t = (double)cv::getTickCount();
     vector<cv::Point2f> corners;
-    cv::goodFeaturesToTrack(img, corners, maxCorners, qualityLevel, minDistance, cv::Mat(), blockSize, false, k);
+    cv::goodFeaturesToTrack(img, corners, maxCorners, qualityLevel, minDistance, mask, blockSize, false, k);
 
     // add corners to result vector
     for (auto it = corners.begin(); it != corners.end(); ++it)
@@ -156,6 +249,13 @@ void detKeypointsShiTomasi(vector<cv::KeyPoint> &keypoints, cv::Mat &img, bool b
         newKeyPoint.size = blockSize;
         keypoints.push_back(newKeyPoint);
     }
+}
+
+// Detect keypoints in image using the traditional Shi-Thomasi detector
+void detKeypointsShiTomasi(vector<cv::KeyPoint> &keypoints, cv::Mat &img, bool bVis, const cv::Mat &mask)
+{
+    double t = (double)cv::getTickCount();
+    detectShiTomasiCorners(keypoints, img, mask);
     t = ((double)cv::getTickCount() - t) / cv::getTickFrequency();
     cout << "Shi-Tomasi codetection with n=" << keypoints.size() << " keypoints in " << 1000 * t / 1.0 << " ms" << endl;
     // cout << 1000 * t / 1.0 << ",";
@@ -167,7 +267,7 @@ void detKeypointsShiTomasi(vector<cv::KeyPoint> &keypoints, cv::Mat &img, bool b
     }
 }
 
-void detKeypointsHarris(vector<cv::KeyPoint> &keypoints, cv::Mat &img, bool bVis)
+void detKeypointsHarris(vector<cv::KeyPoint> &keypoints, cv::Mat &img, bool bVis, const cv::Mat &mask)
 {
     // Detector parameters
     int blockSize = 2; // for every pixel, a blockSize × blockSize neighborhood is considered
@@ -177,25 +277,124 @@ void detKeypointsHarris(vector<cv::KeyPoint> &keypoints, cv::Mat &img, bool bVis
 
     double t = (double)cv::getTickCount();
     // Detect Harris corners and normalize output
-    cv::Mat dst, dst_norm, dst_norm_scaled;
+    cv::Mat dst, dst_norm;
     dst = cv::Mat::zeros(img.size(), CV_32FC1 );
     cv::cornerHarris( img, dst, blockSize, apertureSize, k, cv::BORDER_DEFAULT ); 
     cv::normalize( dst, dst_norm, 0, 255, cv::NORM_MINMAX, CV_32FC1, cv::Mat() );
-    cv::convertScaleAbs( dst_norm, dst_norm_scaled );
 
-    // vector<cv::KeyPoint> kpts;
+    // the response is normalized over the whole image, so that masking does not change the threshold
+    if (!mask.empty())
+    {
+        dst_norm.setTo(0, mask == 0);
+    }
+
+    // local maxima of the response, no two keypoints overlap
+    nmsHarrisGrid(dst_norm, minResponse, 2 * apertureSize, keypoints);
+
+    t = ((double)cv::getTickCount() - t) / cv::getTickFrequency();
+    cout << "Harris detection with n=" << keypoints.size() << " keypoints in " << 1000 * t / 1.0 << " ms" << endl;
+    // cout << 1000 * t / 1.0 << ",";
+    // visualize results
+    if (bVis)
+    {
+        visualizeResults(img, keypoints, "Harris");
+    }
+}
+
+void nmsHarrisGrid(const cv::Mat &response, int minResponse, float keypointSize, std::vector<cv::KeyPoint> &keypoints)
+{
+    // two keypoints overlap if their distance is below keypointSize; a cell with a diagonal below that distance
+    // holds at most one local maximum, so only the best pixel of each cell has to be checked against its neighbourhood
+    int radius = (int)ceil(keypointSize) - 1;
+    float minDistSq = keypointSize * keypointSize;
+    int cellSize = 1;
+    while (2 * cellSize * cellSize < minDistSq)
+    {
+        cellSize++; // largest cell whose diagonal (cellSize - 1) * sqrt(2) is below keypointSize
+    }
+    int cellRows = (response.rows + cellSize - 1) / cellSize;
+    int cellCols = (response.cols + cellSize - 1) / cellSize;
+
+    // q suppresses p if it is stronger or equally strong and comes first in raster order
+    auto isStronger = [&response](int xq, int yq, int xp, int yp) {
+        float vq = response.at<float>(yq, xq), vp = response.at<float>(yp, xp);
+        return vq > vp || (vq == vp && (yq < yp || (yq == yp && xq < xp)));
+    };
+
+    vector<vector<cv::KeyPoint>> rowKeypoints(cellRows);
+    cv::parallel_for_(cv::Range(0, cellRows), [&](const cv::Range &range) {
+        for (int cr = range.start; cr < range.end; ++cr)
+        {
+            int y0 = cr * cellSize, y1 = min(y0 + cellSize, response.rows);
+            for (int cc = 0; cc < cellCols; ++cc)
+            {
+                int x0 = cc * cellSize, x1 = min(x0 + cellSize, response.cols);
+
+                // best pixel of the cell above the threshold
+                int xBest = -1, yBest = -1;
+                for (int y = y0; y < y1; ++y)
+                {
+                    const float *row = response.ptr<float>(y);
+                    for (int x = x0; x < x1; ++x)
+                    {
+                        if ((int)row[x] > minResponse && (xBest < 0 || row[x] > response.at<float>(yBest, xBest)))
+                        {
+                            xBest = x;
+                            yBest = y;
+                        }
+                    }
+                }
+                if (xBest < 0)
+                {
+                    continue;
+                }
+
+                // local maximum test within the keypoint diameter
+                bool bMax = true;
+                for (int y = max(yBest - radius, 0); y <= min(yBest + radius, response.rows - 1) && bMax; ++y)
+                {
+                    for (int x = max(xBest - radius, 0); x <= min(xBest + radius, response.cols - 1); ++x)
+                    {
+                        int dx = x - xBest, dy = y - yBest;
+                        if ((dx != 0 || dy != 0) && dx * dx + dy * dy < minDistSq && isStronger(x, y, xBest, yBest))
+                        {
+                            bMax = false;
+                            break;
+                        }
+                    }
+                }
+                if (bMax)
+                {
+                    cv::KeyPoint newKpt;
+                    newKpt.pt = cv::Point2f(xBest, yBest);
+                    newKpt.size = keypointSize;
+                    newKpt.response = (int)response.at<float>(yBest, xBest);
+                    rowKeypoints[cr].push_back(newKpt);
+                }
+            }
+        }
+    });
+
+    for (auto it = rowKeypoints.begin(); it != rowKeypoints.end(); ++it)
+    {
+        keypoints.insert(keypoints.end(), it->begin(), it->end());
+    }
+}
+
+void nmsHarrisOverlap(const cv::Mat &response, int minResponse, float keypointSize, std::vector<cv::KeyPoint> &keypoints)
+{
     double maxOverlap = 0;
-    for(size_t j = 0; j < dst_norm.rows; j++)
+    for(int j = 0; j < response.rows; j++)
     {
-        for(size_t i = 0; i < dst_norm.cols; i++)
+        for(int i = 0; i < response.cols; i++)
         {
-            int response = dst_norm.at<float>(j, i);
-            if (response > minResponse)
+            int value = response.at<float>(j, i);
+            if (value > minResponse)
             {
                 cv::KeyPoint newKpt;
                 newKpt.pt = cv::Point2f(i, j);
-                newKpt.size = 2 * apertureSize;
-                newKpt.response = response;
+                newKpt.size = keypointSize;
+                newKpt.response = value;
 
                 // nms over neighborhood
                 bool bOverlap = false;
@@ -219,21 +418,13 @@ void detKeypointsHarris(vector<cv::KeyPoint> &keypoints, cv::Mat &img, bool bVis
             }
         }
     }
-    t = ((double)cv::getTickCount() - t) / cv::getTickFrequency();
-    cout << "Harris detection with n=" << keypoints.size() << " keypoints in " << 1000 * t / 1.0 << " ms" << endl;
-    // cout << 1000 * t / 1.0 << ",";
-    // visualize results
-    if (bVis)
-    {
-        visualizeResults(img, keypoints, "Harris");
-    }
 }
 
-void detKeypointsModern(vector<cv::KeyPoint> &keypoints, cv::Mat &img, string detectorType, bool bVis)
-{   
-    double t = (double)cv::getTickCount();
+// Create a keypoint detector with the parameters used throughout this project
+cv::Ptr<cv::FeatureDetector> createDetector(DetectorType detectorType)
+{
     cv::Ptr<cv::FeatureDetector> detector;
-    if (detectorType.compare("FAST") == 0)
+    if (detectorType == DET_FAST)
     {
         int threshold = 30;
         bool nms = true;
@@ -243,7 +434,7 @@ void detKeypointsModern(vector<cv::KeyPoint> &keypoints, cv::Mat &img, string de
         // cv::FAST(img, keypoints, threshold, nms, cv::FastFeatureDetector::TYPE_9_16);
         
     }
-    else if (detectorType.compare("BRISK") == 0)
+    else if (detectorType == DET_BRISK)
     {
         int threshold = 30;
         int octaves = 3;
@@ -251,7 +442,7 @@ void detKeypointsModern(vector<cv::KeyPoint> &keypoints, cv::Mat &img, string de
         detector = cv::BRISK::create(threshold, octaves, patternScale);
 
     }
-    else if (detectorType.compare("ORB") == 0)
+    else if (detectorType == DET_ORB)
     {
         int nfeat = 500;
         float scaleFactor = 1.2f;
@@ -264,7 +455,7 @@ void detKeypointsModern(vector<cv::KeyPoint> &keypoints, cv::Mat &img, string de
         int fastThreshold = 20;
         detector = cv::ORB::create(nfeat, scaleFactor, nLevels, edgeThreshold, firstLevel, wta_k, cv::ORB::HARRIS_SCORE, patchSize, fastThreshold);
     }
-    else if (detectorType.compare("AKAZE") == 0)
+    else if (detectorType == DET_AKAZE)
     {
         bool extended = false;
         bool upright = false;
@@ -275,7 +466,7 @@ void detKeypointsModern(vector<cv::KeyPoint> &keypoints, cv::Mat &img, string de
     }
     else
     {
-        // SIFT
+        // SIFT (also for the classic detectors, which have no detector instance)
         int nfeatures = 0;
         int nOctaveLayers = 3;
         double contrastThreshold = 0.04;
@@ -283,7 +474,14 @@ void detKeypointsModern(vector<cv::KeyPoint> &keypoints, cv::Mat &img, string de
         double sigma = 1.6;
         detector = cv::xfeatures2d::SIFT::create(nfeatures, nOctaveLayers, contrastThreshold, edgeThreshold, sigma);
     }
-    detector->detect(img, keypoints);
+    return detector;
+}
+
+void detKeypointsModern(vector<cv::KeyPoint> &keypoints, cv::Mat &img, string detectorType, bool bVis, const cv::Mat &mask)
+{   
+    double t = (double)cv::getTickCount();
+    cv::Ptr<cv::FeatureDetector> detector = createDetector(getDetectorType(detectorType));
+    detector->detect(img, keypoints, mask);
     t = ((double)cv::getTickCount() - t) / cv::getTickFrequency();
     cout << detectorType << " detection with n=" << keypoints.size() << " keypoints in " << 1000 * t / 1.0 << " ms" << endl;
     // cout << 1000 * t / 1.0 << ",";
@@ -292,4 +490,260 @@ void detKeypointsModern(vector<cv::KeyPoint> &keypoints, cv::Mat &img, string de
     {
         visualizeResults(img, keypoints, detectorType);
     }
-}
\ No newline at end of file
+}
+
+static const char *detectorNames[] = {"SHITOMASI", "HARRIS", "FAST", "BRISK", "ORB", "AKAZE", "SIFT"};
+static const char *descriptorNames[] = {"BRISK", "ORB", "FREAK", "AKAZE", "SIFT"};
+
+DetectorType getDetectorType(std::string name)
+{
+    for (int i = 0; i < DET_SIFT; ++i)
+    {
+        if (name.compare(detectorNames[i]) == 0)
+        {
+            return (DetectorType)i;
+        }
+    }
+    return DET_SIFT;
+}
+
+DescriptorType getDescriptorType(std::string name)
+{
+    for (int i = 0; i < DESC_SIFT; ++i)
+    {
+        if (name.compare(descriptorNames[i]) == 0)
+        {
+            return (DescriptorType)i;
+        }
+    }
+    return DESC_SIFT;
+}
+
+const char *getDetectorName(DetectorType detectorType)
+{
+    return detectorNames[detectorType];
+}
+
+const char *getDescriptorName(DescriptorType descriptorType)
+{
+    return descriptorNames[descriptorType];
+}
+
+FeatureRegistry::FeatureRegistry(DetectorType detectorType, DescriptorType descriptorType)
+    : detectorType(detectorType), descriptorType(descriptorType), tileCols(1), tileRows(1), tileOverlap(0), maxKeypointsPerTile(0)
+{
+    if (detectorType != DET_SHITOMASI && detectorType != DET_HARRIS)
+    {
+        detector = createDetector(detectorType);
+    }
+    extractor = createDescriptorExtractor(descriptorType);
+}
+
+void FeatureRegistry::detect(std::vector<cv::KeyPoint> &keypoints, cv::Mat &img, bool bVis, const cv::Mat &mask)
+{
+    switch (detectorType)
+    {
+    case DET_SHITOMASI:
+        if (tileCols * tileRows > 1)
+        {
+            double t = (double)cv::getTickCount();
+            detectTiled(keypoints, img, mask);
+            t = ((double)cv::getTickCount() - t) / cv::getTickFrequency();
+            cout << "Shi-Tomasi tiled detection with n=" << keypoints.size() << " keypoints in " << 1000 * t / 1.0 << " ms" << endl;
+            if (bVis)
+            {
+                visualizeResults(img, keypoints, "Shi-Tomasi");
+            }
+        }
+        else
+        {
+            detKeypointsShiTomasi(keypoints, img, bVis, mask);
+        }
+        break;
+    case DET_HARRIS:
+        detKeypointsHarris(keypoints, img, bVis, mask);
+        break;
+    default:
+    {
+        double t = (double)cv::getTickCount();
+        if (tileCols * tileRows > 1)
+        {
+            detectTiled(keypoints, img, mask);
+        }
+        else
+        {
+            detector->detect(img, keypoints, mask);
+        }
+        t = ((double)cv::getTickCount() - t) / cv::getTickFrequency();
+        cout << getDetectorName(detectorType) << " detection with n=" << keypoints.size() << " keypoints in " << 1000 * t / 1.0 << " ms" << endl;
+        if (bVis)
+        {
+            visualizeResults(img, keypoints, getDetectorName(detectorType));
+        }
+    }
+    }
+}
+
+void FeatureRegistry::setTiling(int tileCols, int tileRows, int tileOverlap, int maxKeypointsPerTile)
+{
+    this->tileCols = max(tileCols, 1);
+    this->tileRows = max(tileRows, 1);
+    this->tileOverlap = tileOverlap;
+    this->maxKeypointsPerTile = maxKeypointsPerTile;
+
+    // detector instances are not safe to share between threads, so every tile gets its own
+    tileDetectors.clear();
+    if (detectorType != DET_SHITOMASI && detectorType != DET_HARRIS)
+    {
+        for (int i = 0; i < this->tileCols * this->tileRows; ++i)
+        {
+            tileDetectors.push_back(createDetector(detectorType));
+        }
+    }
+}
+
+void FeatureRegistry::detectTiled(std::vector<cv::KeyPoint> &keypoints, cv::Mat &img, const cv::Mat &mask)
+{
+    int nTiles = tileCols * tileRows;
+    vector<vector<cv::KeyPoint>> tileKeypoints(nTiles);
+    cv::Rect imgRect(0, 0, img.cols, img.rows);
+
+    cv::parallel_for_(cv::Range(0, nTiles), [&](const cv::Range &range) {
+        for (int i = range.start; i < range.end; ++i)
+        {
+            // the core tiles partition the image, detection runs on the core plus the overlap to give the detector context at the borders
+            int c = i % tileCols, r = i / tileCols;
+            int x0 = c * img.cols / tileCols, x1 = (c + 1) * img.cols / tileCols;
+            int y0 = r * img.rows / tileRows, y1 = (r + 1) * img.rows / tileRows;
+            cv::Rect core(x0, y0, x1 - x0, y1 - y0);
+            cv::Rect tile = cv::Rect(x0 - tileOverlap, y0 - tileOverlap, x1 - x0 + 2 * tileOverlap, y1 - y0 + 2 * tileOverlap) & imgRect;
+
+            vector<cv::KeyPoint> kpts;
+            cv::Mat tileMask = mask.empty() ? cv::Mat() : mask(tile);
+            if (detectorType == DET_SHITOMASI)
+            {
+                detectShiTomasiCorners(kpts, img(tile), tileMask);
+            }
+            else
+            {
+                tileDetectors[i]->detect(img(tile), kpts, tileMask);
+            }
+
+            // keypoints in the overlap are owned by the neighbouring tile, this removes the duplicates at the borders
+            vector<cv::KeyPoint> &owned = tileKeypoints[i];
+            for (auto it = kpts.begin(); it != kpts.end(); ++it)
+            {
+                it->pt.x += tile.x;
+                it->pt.y += tile.y;
+                if (core.contains(cv::Point((int)it->pt.x, (int)it->pt.y)))
+                {
+                    owned.push_back(*it);
+                }
+            }
+
+            if (maxKeypointsPerTile > 0 && (int)owned.size() > maxKeypointsPerTile)
+            {
+                if (detectorType == DET_SHITOMASI)
+                { // there is no response info, but the corners are sorted in descending quality order
+                    owned.erase(owned.begin() + maxKeypointsPerTile, owned.end());
+                }
+                else
+                {
+                    cv::KeyPointsFilter::retainBest(owned, maxKeypointsPerTile);
+                }
+            }
+        }
+    });
+
+    for (auto it = tileKeypoints.begin(); it != tileKeypoints.end(); ++it)
+    {
+        keypoints.insert(keypoints.end(), it->begin(), it->end());
+    }
+}
+
+void FeatureRegistry::describe(std::vector<cv::KeyPoint> &keypoints, cv::Mat &img, cv::Mat &descriptors, const cv::Mat &mask)
+{
+    double t = (double)cv::getTickCount();
+    if (!mask.empty())
+    {
+        cv::KeyPointsFilter::runByPixelsMask(keypoints, mask);
+    }
+    extractor->compute(img, keypoints, descriptors);
+    t = ((double)cv::getTickCount() - t) / cv::getTickFrequency();
+    cout << getDescriptorName(descriptorType) << " descriptor extraction in " << 1000 * t / 1.0 << " ms" << endl;
+}
+
+double makeBoundingBoxMask(const std::vector<BoundingBox> &boundingBoxes, cv::Size imgSize, float margin, cv::Mat &mask)
+{
+    mask = cv::Mat::zeros(imgSize, CV_8U);
+    cv::Rect imgRect(cv::Point(0, 0), imgSize);
+    for (auto it = boundingBoxes.begin(); it != boundingBoxes.end(); ++it)
+    {
+        int dx = cvRound(margin * it->roi.width), dy = cvRound(margin * it->roi.height);
+        cv::Rect expanded(it->roi.x - dx, it->roi.y - dy, it->roi.width + 2 * dx, it->roi.height + 2 * dy);
+        mask(expanded & imgRect).setTo(255);
+    }
+    return (double)cv::countNonZero(mask) / imgSize.area();
+}
+
+void trackKeypointsKLT(const std::vector<cv::KeyPoint> &kptsPrev, const cv::Mat &imgPrev, const cv::Mat &imgCurr,
+                       std::vector<cv::KeyPoint> &kptsCurr, std::vector<cv::DMatch> &matches, float maxFbError)
+{
+    // tracker parameters
+    cv::Size winSize(21, 21); // search window at each pyramid level
+    int maxLevel = 3;         // no. of pyramid levels above the original image
+    cv::TermCriteria criteria(cv::TermCriteria::COUNT | cv::TermCriteria::EPS, 30, 0.01);
+
+    double t = (double)cv::getTickCount();
+    kptsCurr.clear();
+    matches.clear();
+    if (kptsPrev.size() == 0)
+    {
+        return;
+    }
+    vector<cv::Point2f> prevPts, currPts, backPts;
+    cv::KeyPoint::convert(kptsPrev, prevPts);
+    vector<uchar> status, backStatus;
+    vector<float> err;
+    cv::calcOpticalFlowPyrLK(imgPrev, imgCurr, prevPts, currPts, status, err, winSize, maxLevel, criteria);
+    cv::calcOpticalFlowPyrLK(imgCurr, imgPrev, currPts, backPts, backStatus, err, winSize, maxLevel, criteria);
+
+    cv::Rect imgRect(0, 0, imgCurr.cols, imgCurr.rows);
+    for (size_t i = 0; i < prevPts.size(); ++i)
+    {
+        float fbError = (float)cv::norm(backPts[i] - prevPts[i]);
+        if (status[i] && backStatus[i] && fbError <= maxFbError && imgRect.contains(cv::Point((int)currPts[i].x, (int)currPts[i].y)))
+        {
+            cv::KeyPoint kpt = kptsPrev[i];
+            kpt.pt = currPts[i];
+            matches.push_back(cv::DMatch((int)i, (int)kptsCurr.size(), fbError));
+            kptsCurr.push_back(kpt);
+        }
+    }
+    t = ((double)cv::getTickCount() - t) / cv::getTickFrequency();
+    cout << "KLT tracking of n=" << kptsPrev.size() << " keypoints, " << kptsCurr.size() << " kept in " << 1000 * t / 1.0 << " ms" << endl;
+}
+
+int addUntrackedKeypoints(std::vector<cv::KeyPoint> &keypoints, const std::vector<cv::KeyPoint> &detected, cv::Size imgSize, float minDistance)
+{
+    // occupancy raster of the existing keypoints
+    cv::Mat occupied = cv::Mat::zeros(imgSize, CV_8U);
+    int radius = max(cvRound(minDistance), 1);
+    for (auto it = keypoints.begin(); it != keypoints.end(); ++it)
+    {
+        cv::circle(occupied, it->pt, radius, cv::Scalar(255), cv::FILLED);
+    }
+
+    int nAdded = 0;
+    for (auto it = detected.begin(); it != detected.end(); ++it)
+    {
+        cv::Point pt((int)it->pt.x, (int)it->pt.y);
+        if (pt.x >= 0 && pt.y >= 0 && pt.x < imgSize.width && pt.y < imgSize.height && occupied.at<uchar>(pt) == 0)
+        {
+            keypoints.push_back(*it);
+            cv::circle(occupied, it->pt, radius, cv::Scalar(255), cv::FILLED);
+            nAdded++;
+        }
+    }
+    return nAdded;
+}
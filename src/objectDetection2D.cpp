@@ -2,87 +2,140 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <cfloat>
 
 #include <opencv2/dnn.hpp>
 #include <opencv2/imgproc.hpp>
 #include <opencv2/highgui.hpp>
+#include <opencv2/core/hal/intrin.hpp>
 
 #include "objectDetection2D.hpp"
 
 
 using namespace std;
 
-// detects objects in an image using the YOLO library and a set of pre-trained objects from the COCO database;
-// a set of 80 classes is listed in "coco.names" and pre-trained weights are stored in "yolov3.weights"
-void detectObjects(cv::Mat& img, std::vector<BoundingBox>& bBoxes, float confThreshold, float nmsThreshold, 
-                   std::string basePath, std::string classesFile, std::string modelConfiguration, std::string modelWeights, bool bVis)
+// loads the class names, the YOLO network and the names of its output layers once for the whole sequence
+ObjectDetector::ObjectDetector(std::string classesFile, std::string modelConfiguration, std::string modelWeights, cv::Size inputSize)
+    : inputSize(inputSize)
 {
+    double t = (double)cv::getTickCount();
+
     // load class names from file
-    vector<string> classes;
     ifstream ifs(classesFile.c_str());
     string line;
     while (getline(ifs, line)) classes.push_back(line);
     
     // load neural network
-    cv::dnn::Net net = cv::dnn::readNetFromDarknet(modelConfiguration, modelWeights);
+    net = cv::dnn::readNetFromDarknet(modelConfiguration, modelWeights);
     net.setPreferableBackend(cv::dnn::DNN_BACKEND_OPENCV);
     net.setPreferableTarget(cv::dnn::DNN_TARGET_CPU);
+
+    // Get names of output layers
+    vector<int> outLayers = net.getUnconnectedOutLayers(); // get  indices of  output layers, i.e.  layers with unconnected outputs
+    vector<cv::String> layersNames = net.getLayerNames(); // get  names of all layers in the network
     
+    outNames.resize(outLayers.size());
+    for (size_t i = 0; i < outLayers.size(); ++i) // Get the names of the output layers in names
+        outNames[i] = layersNames[outLayers[i] - 1];
+
+    loadTime = ((double)cv::getTickCount() - t) / cv::getTickFrequency();
+    inferenceTime = 0.0;
+    cout << "YOLO network " << modelWeights << " (" << inputSize.width << "x" << inputSize.height << ") loaded in " << 1000 * loadTime / 1.0 << " ms" << endl;
+}
+
+// detects objects in an image using the YOLO library and a set of pre-trained objects from the COCO database;
+// a set of 80 classes is listed in "coco.names" and pre-trained weights are stored in "yolov3.weights"
+void ObjectDetector::detect(cv::Mat& img, std::vector<BoundingBox>& bBoxes, float confThreshold, float nmsThreshold, bool bVis)
+{
+    double t = (double)cv::getTickCount();
+
     // generate 4D blob from input image
-    cv::Mat blob;
-    vector<cv::Mat> netOutput;
     double scalefactor = 1/255.0;
-    cv::Size size = cv::Size(416, 416);
+    cv::Size size = inputSize;
     cv::Scalar mean = cv::Scalar(0,0,0);
     bool swapRB = false;
     bool crop = false;
     cv::dnn::blobFromImage(img, blob, scalefactor, size, mean, swapRB, crop);
     
-    // Get names of output layers
-    vector<cv::String> names;
-    vector<int> outLayers = net.getUnconnectedOutLayers(); // get  indices of  output layers, i.e.  layers with unconnected outputs
-    vector<cv::String> layersNames = net.getLayerNames(); // get  names of all layers in the network
-    
-    names.resize(outLayers.size());
-    for (size_t i = 0; i < outLayers.size(); ++i) // Get the names of the output layers in names
-        names[i] = layersNames[outLayers[i] - 1];
-    
     // invoke forward propagation through network
     net.setInput(blob);
-    net.forward(netOutput, names);
+    net.forward(netOutput, outNames);
+
+    decodeOutput(0, 1, img.size(), confThreshold, nmsThreshold, bBoxes);
+
+    inferenceTime = ((double)cv::getTickCount() - t) / cv::getTickFrequency();
     
+    // show results
+    if(bVis) {
+        visualize(img, bBoxes);
+    }
+}
+
+// detects objects in several images at once; all images must have the same size (e.g. consecutive KITTI frames)
+void ObjectDetector::detectBatch(std::vector<cv::Mat>& imgs, std::vector<std::vector<BoundingBox>>& bBoxes, float confThreshold, float nmsThreshold, bool bVis)
+{
+    double t = (double)cv::getTickCount();
+    bBoxes.resize(imgs.size());
+    if (imgs.empty())
+    {
+        inferenceTime = 0.0;
+        return;
+    }
+
+    // generate one 4D blob (N x 3 x H x W) from all input images
+    double scalefactor = 1/255.0;
+    cv::Size size = inputSize;
+    cv::Scalar mean = cv::Scalar(0,0,0);
+    bool swapRB = false;
+    bool crop = false;
+    cv::dnn::blobFromImages(imgs, blob, scalefactor, size, mean, swapRB, crop);
+
+    // invoke a single forward propagation for the whole batch
+    net.setInput(blob);
+    net.forward(netOutput, outNames);
+
+    // split decoded boxes back to their source images
+    for (size_t k = 0; k < imgs.size(); ++k)
+    {
+        decodeOutput((int)k, (int)imgs.size(), imgs[k].size(), confThreshold, nmsThreshold, bBoxes[k]);
+    }
+
+    inferenceTime = ((double)cv::getTickCount() - t) / cv::getTickFrequency();
+
+    // show results
+    if(bVis) {
+        for (size_t k = 0; k < imgs.size(); ++k)
+        {
+            visualize(imgs[k], bBoxes[k]);
+        }
+    }
+}
+
+// converts the rows of image batchIdx within netOutput into bounding boxes and performs non-maxima suppression
+void ObjectDetector::decodeOutput(int batchIdx, int batchSize, cv::Size imgSize, float confThreshold, float nmsThreshold, std::vector<BoundingBox>& bBoxes)
+{
     // Scan through all bounding boxes and keep only the ones with high confidence
-    vector<int> classIds; vector<float> confidences; vector<cv::Rect> boxes;
+    classIds.clear(); confidences.clear(); boxes.clear();
     for (size_t i = 0; i < netOutput.size(); ++i)
     {
-        float* data = (float*)netOutput[i].data;
-        for (int j = 0; j < netOutput[i].rows; ++j, data += netOutput[i].cols)
+        // region layers return (rows x cols) for a single image and either (N x rows x cols) or (N*rows x cols) for a batch
+        int rows, cols;
+        if (netOutput[i].dims == 3)
         {
-            cv::Mat scores = netOutput[i].row(j).colRange(5, netOutput[i].cols);
-            cv::Point classId;
-            double confidence;
-            
-            // Get the value and location of the maximum score
-            cv::minMaxLoc(scores, 0, &confidence, 0, &classId);
-            if (confidence > confThreshold)
-            {
-                cv::Rect box; int cx, cy;
-                cx = (int)(data[0] * img.cols);
-                cy = (int)(data[1] * img.rows);
-                box.width = (int)(data[2] * img.cols);
-                box.height = (int)(data[3] * img.rows);
-                box.x = cx - box.width/2; // left
-                box.y = cy - box.height/2; // top
-                
-                boxes.push_back(box);
-                classIds.push_back(classId.x);
-                confidences.push_back((float)confidence);
-            }
+            rows = netOutput[i].size[1];
+            cols = netOutput[i].size[2];
         }
+        else
+        {
+            rows = netOutput[i].rows / batchSize;
+            cols = netOutput[i].cols;
+        }
+
+        const float* data = (const float*)netOutput[i].data + (size_t)batchIdx * rows * cols;
+        decodeYoloOutput(data, rows, cols, imgSize, confThreshold, classIds, confidences, boxes);
     }
     
     // perform non-maxima suppression
-    vector<int> indices;
     cv::dnn::NMSBoxes(boxes, confidences, confThreshold, nmsThreshold, indices);
     for(auto it=indices.begin(); it!=indices.end(); ++it) {
         
@@ -94,36 +147,192 @@ void detectObjects(cv::Mat& img, std::vector<BoundingBox>& bBoxes, float confThr
         
         bBoxes.push_back(bBox);
     }
-    
-    // show results
-    if(bVis) {
+}
+
+void ObjectDetector::visualize(cv::Mat& img, std::vector<BoundingBox>& bBoxes)
+{
+    cv::Mat visImg = img.clone();
+    for(auto it=bBoxes.begin(); it!=bBoxes.end(); ++it) {
         
-        cv::Mat visImg = img.clone();
-        for(auto it=bBoxes.begin(); it!=bBoxes.end(); ++it) {
-            
-            // Draw rectangle displaying the bounding box
-            int top, left, width, height;
-            top = (*it).roi.y;
-            left = (*it).roi.x;
-            width = (*it).roi.width;
-            height = (*it).roi.height;
-            cv::rectangle(visImg, cv::Point(left, top), cv::Point(left+width, top+height),cv::Scalar(0, 255, 0), 2);
-            
-            string label = cv::format("%.2f", (*it).confidence);
-            label = classes[((*it).classID)] + ":" + label;
+        // Draw rectangle displaying the bounding box
+        int top, left, width, height;
+        top = (*it).roi.y;
+        left = (*it).roi.x;
+        width = (*it).roi.width;
+        height = (*it).roi.height;
+        cv::rectangle(visImg, cv::Point(left, top), cv::Point(left+width, top+height),cv::Scalar(0, 255, 0), 2);
         
-            // Display label at the top of the bounding box
-            int baseLine;
-            cv::Size labelSize = getTextSize(label, cv::FONT_ITALIC, 0.5, 1, &baseLine);
-            top = max(top, labelSize.height);
-            rectangle(visImg, cv::Point(left, top - round(1.5*labelSize.height)), cv::Point(left + round(1.5*labelSize.width), top + baseLine), cv::Scalar(255, 255, 255), cv::FILLED);
-            cv::putText(visImg, label, cv::Point(left, top), cv::FONT_ITALIC, 0.75, cv::Scalar(0,0,0),1);
-            
-        }
+        string label = cv::format("%.2f", (*it).confidence);
+        label = classes[((*it).classID)] + ":" + label;
+    
+        // Display label at the top of the bounding box
+        int baseLine;
+        cv::Size labelSize = getTextSize(label, cv::FONT_ITALIC, 0.5, 1, &baseLine);
+        top = max(top, labelSize.height);
+        rectangle(visImg, cv::Point(left, top - round(1.5*labelSize.height)), cv::Point(left + round(1.5*labelSize.width), top + baseLine), cv::Scalar(255, 255, 255), cv::FILLED);
+        cv::putText(visImg, label, cv::Point(left, top), cv::FONT_ITALIC, 0.75, cv::Scalar(0,0,0),1);
         
-        string windowName = "Object classification";
-        cv::namedWindow( windowName, 1 );
-        cv::imshow( windowName, visImg );
-        cv::waitKey(0); // wait for key to be pressed
+    }
+    
+    string windowName = "Object classification";
+    cv::namedWindow( windowName, 1 );
+    cv::imshow( windowName, visImg );
+    cv::waitKey(0); // wait for key to be pressed
+}
+
+// intersection over union of two boxes
+static double boxIoU(const cv::Rect &a, const cv::Rect &b)
+{
+    double inter = (a & b).area();
+    double uni = a.area() + b.area() - inter;
+    return uni > 0 ? inter / uni : 0.0;
+}
+
+void compareDetectors(std::vector<cv::Mat>& imgs, std::string yoloBasePath, std::string classesFile, float confThreshold, float nmsThreshold)
+{
+    // reference: full yolov3 at its default input size
+    vector<string> models = {"yolov3", "yolov3", "yolov3", "yolov3-tiny", "yolov3-tiny", "yolov3-tiny"};
+    vector<int> inputSizes = {416, 320, 608, 416, 320, 608};
+
+    vector<vector<BoundingBox>> refBoxes(imgs.size());
+    cout << "model, input size, mean latency [ms], max latency [ms], mean #boxes, mean IoU vs ref, recall@0.5 vs ref" << endl;
+    for (size_t m = 0; m < models.size(); ++m)
+    {
+        ObjectDetector detector(classesFile, yoloBasePath + models[m] + ".cfg", yoloBasePath + models[m] + ".weights",
+                                cv::Size(inputSizes[m], inputSizes[m]));
+
+        double sumTime = 0.0, maxTime = 0.0, sumIoU = 0.0;
+        int nBoxes = 0, nRefBoxes = 0, nRecalled = 0;
+        for (size_t k = 0; k < imgs.size(); ++k)
+        {
+            vector<BoundingBox> bBoxes;
+            detector.detect(imgs[k], bBoxes, confThreshold, nmsThreshold, false);
+            sumTime += detector.inferenceTime;
+            maxTime = max(maxTime, detector.inferenceTime);
+            nBoxes += bBoxes.size();
+
+            if (m == 0)
+            {
+                refBoxes[k] = bBoxes;
+            }
+
+            // agreement: best IoU of each reference box with a box of the same class
+            for (auto it1 = refBoxes[k].begin(); it1 != refBoxes[k].end(); ++it1)
+            {
+                double bestIoU = 0.0;
+                for (auto it2 = bBoxes.begin(); it2 != bBoxes.end(); ++it2)
+                {
+                    if (it1->classID == it2->classID)
+                    {
+                        bestIoU = max(bestIoU, boxIoU(it1->roi, it2->roi));
+                    }
+                }
+                sumIoU += bestIoU;
+                nRecalled += bestIoU >= 0.5 ? 1 : 0;
+                nRefBoxes++;
+            }
+        }
+
+        int nImgs = max((int)imgs.size(), 1);
+        cout << models[m] << ", " << inputSizes[m] << ", " << 1000 * sumTime / nImgs << ", " << 1000 * maxTime << ", " << (double)nBoxes / nImgs << ", "
+             << (nRefBoxes > 0 ? sumIoU / nRefBoxes : 0.0) << ", " << (nRefBoxes > 0 ? (double)nRecalled / nRefBoxes : 0.0) << endl;
+    }
+}
+
+// one-shot version of ObjectDetector::detect which loads the network for a single image
+void detectObjects(cv::Mat& img, std::vector<BoundingBox>& bBoxes, float confThreshold, float nmsThreshold, 
+                   std::string basePath, std::string classesFile, std::string modelConfiguration, std::string modelWeights, bool bVis)
+{
+    ObjectDetector detector(classesFile, modelConfiguration, modelWeights);
+    detector.detect(img, bBoxes, confThreshold, nmsThreshold, bVis);
+}
+
+// returns the index of the first maximum in scores[0..n-1] (same tie-breaking as cv::minMaxLoc)
+static inline int argmaxScore(const float *scores, int n, float &maxScore)
+{
+    float best = -FLT_MAX;
+    int k = 0;
+#if CV_SIMD
+    const int nlanes = cv::v_float32::nlanes;
+    if (n >= nlanes)
+    {
+        cv::v_float32 vmax = cv::vx_load(scores);
+        for (k = nlanes; k <= n - nlanes; k += nlanes)
+        {
+            vmax = cv::v_max(vmax, cv::vx_load(scores + k));
+        }
+        best = cv::v_reduce_max(vmax);
+    }
+#endif
+    for (; k < n; ++k)
+    {
+        best = scores[k] > best ? scores[k] : best;
+    }
+
+    int idx = 0;
+    while (idx < n - 1 && scores[idx] != best)
+    {
+        ++idx;
+    }
+    maxScore = best;
+    return idx;
+}
+
+void decodeYoloOutput(const float *data, int rows, int cols, cv::Size imgSize, float confThreshold,
+                      std::vector<int> &classIds, std::vector<float> &confidences, std::vector<cv::Rect> &boxes)
+{
+    for (int j = 0; j < rows; ++j, data += cols)
+    {
+        // class scores are objectness * class probability, so no class can beat the threshold if the objectness does not
+        if (data[4] <= confThreshold)
+        {
+            continue;
+        }
+
+        // Get the value and location of the maximum score
+        float confidence;
+        int classId = argmaxScore(data + 5, cols - 5, confidence);
+        if (confidence > confThreshold)
+        {
+            cv::Rect box; int cx, cy;
+            cx = (int)(data[0] * imgSize.width);
+            cy = (int)(data[1] * imgSize.height);
+            box.width = (int)(data[2] * imgSize.width);
+            box.height = (int)(data[3] * imgSize.height);
+            box.x = cx - box.width/2; // left
+            box.y = cy - box.height/2; // top
+
+            boxes.push_back(box);
+            classIds.push_back(classId);
+            confidences.push_back(confidence);
+        }
+    }
+}
+
+void decodeYoloOutputMinMaxLoc(const float *data, int rows, int cols, cv::Size imgSize, float confThreshold,
+                               std::vector<int> &classIds, std::vector<float> &confidences, std::vector<cv::Rect> &boxes)
+{
+    for (int j = 0; j < rows; ++j, data += cols)
+    {
+        cv::Mat scores(1, cols - 5, CV_32F, (void*)(data + 5));
+        cv::Point classId;
+        double confidence;
+
+        // Get the value and location of the maximum score
+        cv::minMaxLoc(scores, 0, &confidence, 0, &classId);
+        if (confidence > confThreshold)
+        {
+            cv::Rect box; int cx, cy;
+            cx = (int)(data[0] * imgSize.width);
+            cy = (int)(data[1] * imgSize.height);
+            box.width = (int)(data[2] * imgSize.width);
+            box.height = (int)(data[3] * imgSize.height);
+            box.x = cx - box.width/2; // left
+            box.y = cy - box.height/2; // top
+
+            boxes.push_back(box);
+            classIds.push_back(classId.x);
+            confidences.push_back((float)confidence);
+        }
     }
 }
@@ -4,10 +4,55 @@
 
 #include <stdio.h>
 #include <opencv2/core.hpp>
+#include <opencv2/dnn.hpp>
 
 #include "dataStructures.h"
 
-void detectObjects(cv::Mat& img, std::vector<BoundingBox>& bBoxes, float confThreshold, float nmsThreshold, 
+// long-lived YOLO session: class names, network and output layer names are loaded once in the constructor
+// and reused by every call to detect(), together with the blob and output buffers of the previous frame
+class ObjectDetector
+{
+public:
+    ObjectDetector(std::string classesFile, std::string modelConfiguration, std::string modelWeights, cv::Size inputSize=cv::Size(416, 416));
+
+    void detect(cv::Mat& img, std::vector<BoundingBox>& bBoxes, float confThreshold, float nmsThreshold, bool bVis);
+    // packs all images into one 4D blob and runs a single forward pass; bBoxes[k] receives the objects of imgs[k]
+    void detectBatch(std::vector<cv::Mat>& imgs, std::vector<std::vector<BoundingBox>>& bBoxes, float confThreshold, float nmsThreshold, bool bVis);
+
+    double loadTime;      // time spent loading class names and network in [s]
+    double inferenceTime; // time spent in the last call to detect() or detectBatch() (blob, forward pass, decoding, nms) in [s]
+    cv::Size inputSize;   // network input resolution, width and height must be multiples of 32
+
+private:
+    void decodeOutput(int batchIdx, int batchSize, cv::Size imgSize, float confThreshold, float nmsThreshold, std::vector<BoundingBox>& bBoxes);
+    void visualize(cv::Mat& img, std::vector<BoundingBox>& bBoxes);
+
+    std::vector<std::string> classes; // class names from "coco.names"
+    cv::dnn::Net net;
+    std::vector<cv::String> outNames; // names of the unconnected output layers
+
+    cv::Mat blob;                     // reused 4D input blob
+    std::vector<cv::Mat> netOutput;   // reused output buffers of the forward pass
+
+    std::vector<int> classIds;        // reused candidate boxes of the decoding step
+    std::vector<float> confidences;
+    std::vector<cv::Rect> boxes;
+    std::vector<int> indices;
+};
+
+// decodes the rows [cx, cy, w, h, objectness, class scores...] of a YOLO region layer output and appends all boxes
+// whose best class score exceeds confThreshold; rows are rejected on objectness first and the class argmax is vectorized
+void decodeYoloOutput(const float *data, int rows, int cols, cv::Size imgSize, float confThreshold,
+                      std::vector<int> &classIds, std::vector<float> &confidences, std::vector<cv::Rect> &boxes);
+// reference decoder using cv::minMaxLoc on every row (kept for benchmarking)
+void decodeYoloOutputMinMaxLoc(const float *data, int rows, int cols, cv::Size imgSize, float confThreshold,
+                               std::vector<int> &classIds, std::vector<float> &confidences, std::vector<cv::Rect> &boxes);
+
+// runs yolov3 and yolov3-tiny at several input sizes over all images and reports latency, box counts and the agreement (IoU)
+// of each configuration with yolov3 at 416x416
+void compareDetectors(std::vector<cv::Mat>& imgs, std::string yoloBasePath, std::string classesFile, float confThreshold, float nmsThreshold);
+
+void detectObjects(cv::Mat& img, std::vector<BoundingBox>& bBoxes, float confThreshold, float nmsThreshold,
                    std::string basePath, std::string classesFile, std::string modelConfiguration, std::string modelWeights, bool bVis);
 
 #endif /* objectDetection2D_hpp */